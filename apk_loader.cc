@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "apk_loader.h"
+
+namespace {
+constexpr uint32_t kEndOfCentralDirSignature = 0x06054b50;
+constexpr uint32_t kCentralDirSignature = 0x02014b50;
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr size_t kEndOfCentralDirSize = 22;
+constexpr size_t kCentralDirEntrySize = 46;
+constexpr size_t kLocalHeaderSize = 30;
+constexpr uint16_t kStored = 0;
+constexpr uint16_t kDeflated = 8;
+
+template <class T> T Read(const uint8_t *ptr) {
+  T value;
+  std::memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+// classes.dex -> 1, classes2.dex -> 2, everything else -> 0
+size_t DexNumber(std::string_view name) {
+  constexpr std::string_view prefix = "classes", suffix = ".dex";
+  if (name.size() < prefix.size() + suffix.size() ||
+      name.substr(0, prefix.size()) != prefix ||
+      name.substr(name.size() - suffix.size()) != suffix)
+    return 0;
+  auto number =
+      name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+  if (number.empty())
+    return 1;
+  if (number[0] == '0')
+    return 0;
+  size_t out = 0;
+  for (char c : number) {
+    if (c < '0' || c > '9')
+      return 0;
+    out = out * 10 + (c - '0');
+  }
+  return out >= 2 ? out : 0;
+}
+
+size_t PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+} // namespace
+
+ApkLoader::ApkLoader(std::string_view apk_path) {
+  fd_ = open(std::string(apk_path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ == -1)
+    return;
+  struct stat s {};
+  if (fstat(fd_, &s) == -1)
+    return;
+  file_size_ = s.st_size;
+
+  std::vector<Entry> entries;
+  if (!ReadCentralDirectory(entries))
+    return;
+
+  std::vector<const void *> images(entries.size(), nullptr);
+  std::vector<size_t> data_offsets(entries.size());
+  std::vector<size_t> to_inflate;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto &entry = entries[i];
+    data_offsets[i] = DataOffset(entry);
+    if (data_offsets[i] == 0)
+      return;
+    // the dex structures need 4-byte alignment, which zipalign guarantees
+    // for stored entries; anything else goes through a copy
+    if (entry.method == kStored && data_offsets[i] % 4 == 0) {
+      images[i] = MapStored(entry, data_offsets[i]);
+      if (!images[i])
+        return;
+    } else {
+      to_inflate.emplace_back(i);
+    }
+  }
+
+  std::atomic_size_t next = 0;
+  auto worker = [&] {
+    for (size_t i; (i = next++) < to_inflate.size();) {
+      auto idx = to_inflate[i];
+      images[idx] = Inflate(entries[idx], data_offsets[idx]);
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t thread_count = std::min<size_t>(
+      to_inflate.size(), std::max(1u, std::thread::hardware_concurrency()));
+  for (size_t i = 1; i < thread_count; ++i)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].method != kStored || data_offsets[i] % 4 != 0) {
+      if (!images[i])
+        continue;
+      buffers_.emplace_back(const_cast<void *>(images[i]));
+    }
+  }
+  if (std::find(images.begin(), images.end(), nullptr) != images.end())
+    return;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    dexs_.emplace_back(images[i], entries[i].size);
+  }
+}
+
+ApkLoader::~ApkLoader() {
+  for (auto &[addr, size] : mappings_) {
+    munmap(addr, size);
+  }
+  for (auto *buffer : buffers_) {
+    std::free(buffer);
+  }
+  if (fd_ != -1)
+    close(fd_);
+}
+
+bool ApkLoader::ReadCentralDirectory(std::vector<Entry> &entries) {
+  if (file_size_ < kEndOfCentralDirSize)
+    return false;
+  // the eocd record is followed by a comment of at most 64k
+  size_t tail_size = std::min(file_size_, kEndOfCentralDirSize + 0xffff);
+  std::vector<uint8_t> tail(tail_size);
+  if (pread(fd_, tail.data(), tail_size, file_size_ - tail_size) !=
+      ssize_t(tail_size))
+    return false;
+  const uint8_t *eocd = nullptr;
+  for (size_t pos = tail_size - kEndOfCentralDirSize + 1; pos-- > 0;) {
+    if (Read<uint32_t>(&tail[pos]) == kEndOfCentralDirSignature) {
+      eocd = &tail[pos];
+      break;
+    }
+  }
+  if (!eocd)
+    return false;
+  auto entry_count = Read<uint16_t>(eocd + 10);
+  auto dir_size = Read<uint32_t>(eocd + 12);
+  auto dir_offset = Read<uint32_t>(eocd + 16);
+  // zip64 archives are not supported
+  if (size_t(dir_offset) + dir_size > file_size_)
+    return false;
+
+  std::vector<uint8_t> dir(dir_size);
+  if (pread(fd_, dir.data(), dir_size, dir_offset) != ssize_t(dir_size))
+    return false;
+
+  std::map<size_t, Entry> dexs;
+  for (size_t i = 0, pos = 0; i < entry_count; ++i) {
+    if (pos + kCentralDirEntrySize > dir_size)
+      return false;
+    const uint8_t *record = &dir[pos];
+    if (Read<uint32_t>(record) != kCentralDirSignature)
+      return false;
+    auto name_size = Read<uint16_t>(record + 28);
+    auto extra_size = Read<uint16_t>(record + 30);
+    auto comment_size = Read<uint16_t>(record + 32);
+    if (pos + kCentralDirEntrySize + name_size > dir_size)
+      return false;
+    std::string_view name(
+        reinterpret_cast<const char *>(record + kCentralDirEntrySize),
+        name_size);
+    if (auto number = DexNumber(name); number != 0) {
+      dexs[number] = {
+          .method = Read<uint16_t>(record + 10),
+          .compressed_size = Read<uint32_t>(record + 20),
+          .size = Read<uint32_t>(record + 24),
+          .local_header_offset = Read<uint32_t>(record + 42),
+      };
+    }
+    pos += kCentralDirEntrySize + name_size + extra_size + comment_size;
+  }
+
+  // like the runtime, stop at the first missing classesN.dex
+  for (size_t number = 1; dexs.count(number); ++number) {
+    auto &entry = dexs[number];
+    if (entry.method != kStored && entry.method != kDeflated)
+      return false;
+    entries.emplace_back(entry);
+  }
+  return true;
+}
+
+size_t ApkLoader::DataOffset(const Entry &entry) const {
+  uint8_t header[kLocalHeaderSize];
+  if (pread(fd_, header, sizeof(header), entry.local_header_offset) !=
+      ssize_t(sizeof(header)))
+    return 0;
+  if (Read<uint32_t>(header) != kLocalHeaderSignature)
+    return 0;
+  size_t offset = size_t(entry.local_header_offset) + kLocalHeaderSize +
+                  Read<uint16_t>(header + 26) + Read<uint16_t>(header + 28);
+  if (offset + entry.compressed_size > file_size_)
+    return 0;
+  return offset;
+}
+
+const void *ApkLoader::MapStored(const Entry &entry, size_t data_offset) {
+  size_t map_offset = data_offset & ~(PageSize() - 1);
+  size_t map_size = data_offset - map_offset + entry.size;
+  void *addr =
+      mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd_, off_t(map_offset));
+  if (addr == MAP_FAILED)
+    return nullptr;
+  mappings_.emplace_back(addr, map_size);
+  return static_cast<const uint8_t *>(addr) + (data_offset - map_offset);
+}
+
+const void *ApkLoader::Inflate(const Entry &entry, size_t data_offset) {
+  size_t capacity = (size_t(entry.size) + PageSize() - 1) & ~(PageSize() - 1);
+  auto *out = static_cast<uint8_t *>(
+      std::aligned_alloc(PageSize(), std::max(capacity, PageSize())));
+  if (!out)
+    return nullptr;
+
+  if (entry.method == kStored) {
+    if (pread(fd_, out, entry.size, data_offset) != ssize_t(entry.size)) {
+      std::free(out);
+      return nullptr;
+    }
+    return out;
+  }
+
+  size_t map_offset = data_offset & ~(PageSize() - 1);
+  size_t map_size = data_offset - map_offset + entry.compressed_size;
+  void *in =
+      mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd_, off_t(map_offset));
+  if (in == MAP_FAILED) {
+    std::free(out);
+    return nullptr;
+  }
+  madvise(in, map_size, MADV_SEQUENTIAL);
+
+  z_stream stream{};
+  bool ok = inflateInit2(&stream, -MAX_WBITS) == Z_OK;
+  if (ok) {
+    stream.next_in = static_cast<Bytef *>(in) + (data_offset - map_offset);
+    stream.avail_in = entry.compressed_size;
+    stream.next_out = out;
+    stream.avail_out = entry.size;
+    ok = inflate(&stream, Z_FINISH) == Z_STREAM_END &&
+         stream.total_out == entry.size;
+    inflateEnd(&stream);
+  }
+  munmap(in, map_size);
+  if (!ok) {
+    std::free(out);
+    return nullptr;
+  }
+  return out;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// Loads classes.dex, classes2.dex, ... straight out of an apk.
+// STORED entries are mapped in place without copying, DEFLATED entries are
+// inflated in parallel into owned page-aligned buffers. The images stay
+// valid for the lifetime of the loader.
+class ApkLoader {
+public:
+  explicit ApkLoader(std::string_view apk_path);
+  ~ApkLoader();
+
+  ApkLoader(const ApkLoader &) = delete;
+  ApkLoader &operator=(const ApkLoader &) = delete;
+
+  // in the order DexHelper expects them, empty if the apk cannot be read
+  const std::vector<std::tuple<const void *, size_t>> &Dexes() const {
+    return dexs_;
+  }
+
+private:
+  struct Entry {
+    uint16_t method;
+    uint32_t compressed_size;
+    uint32_t size;
+    uint32_t local_header_offset;
+  };
+
+  bool ReadCentralDirectory(std::vector<Entry> &entries);
+  const void *MapStored(const Entry &entry, size_t data_offset);
+  const void *Inflate(const Entry &entry, size_t data_offset);
+  size_t DataOffset(const Entry &entry) const;
+
+  int fd_ = -1;
+  size_t file_size_ = 0;
+  std::vector<std::tuple<const void *, size_t>> dexs_;
+  // mmap'd regions of stored entries
+  std::vector<std::tuple<void *, size_t>> mappings_;
+  // inflated images
+  std::vector<void *> buffers_;
+};
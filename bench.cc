@@ -0,0 +1,609 @@
+#include "dex_generator.h"
+#include "dex_helper.h"
+#include "dex_opcodes.h"
+#include "slicer/chronometer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using DexList = std::vector<std::tuple<const void *, size_t>>;
+
+struct Config {
+  SyntheticDexOptions dex;
+  size_t iterations = 5;
+  size_t samples = 20;
+  // where to write the dex files for the file-backed benchmarks
+  std::string dir;
+  // only write the dex files there and exit
+  bool write_only = false;
+  DexHelper::Options helper;
+};
+
+double Time(const std::function<void()> &fn) {
+  double ms = 0;
+  {
+    slicer::Chronometer chronometer(ms);
+    fn();
+  }
+  return ms;
+}
+
+void Report(std::string_view name, std::vector<double> ms) {
+  if (ms.empty())
+    return;
+  std::sort(ms.begin(), ms.end());
+  auto mean = std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+  printf("%-44.*s n=%-4zu min %10.3f  median %10.3f  mean %10.3f ms\n",
+         int(name.size()), name.data(), ms.size(), ms.front(),
+         ms[ms.size() / 2], mean);
+}
+
+void Report(std::string_view name, double value, const char *unit) {
+  printf("%-44.*s %14.1f %s\n", int(name.size()), name.data(), value, unit);
+}
+
+// hardware counters averaged over count calls
+void Report(std::string_view name, const perf::Counters &counters,
+            size_t count) {
+  if (count == 0)
+    return;
+  printf("%-44.*s cycles %12.0f  ipc %5.2f  branch-miss %9.0f  "
+         "llc-miss %9.0f\n",
+         int(name.size()), name.data(), double(counters.cycles) / count,
+         counters.cycles ? double(counters.instructions) / counters.cycles : 0,
+         double(counters.branch_misses) / count,
+         double(counters.cache_misses) / count);
+}
+
+void ReportQueryCounters(std::string_view prefix) {
+  static constexpr const char *kKinds[] = {
+      "FindMethodUsingString",     "FindMethodInvoking",
+      "FindMethodInvoked",         "FindMethodGettingField",
+      "FindMethodSettingField",    "FindField",
+      "FindMethodSetUsingString",  "FindMethodSetInvoking",
+      "FindMethodSetInvoked",      "FindMethodSetGettingField",
+      "FindMethodSetSettingField", "FindMethodSetOfClass",
+      "FindMethodSetMatching",
+  };
+  static_assert(sizeof(kKinds) / sizeof(*kKinds) ==
+                DexHelper::kQueryKindCount);
+  auto stats = DexHelper::GlobalQueryStats();
+  for (size_t kind = 0; kind < stats.size(); ++kind) {
+    Report(std::string(prefix) + kKinds[kind], stats[kind].counters,
+           stats[kind].queries);
+  }
+}
+
+size_t RssBytes() {
+  size_t pages = 0, resident = 0;
+  if (FILE *statm = fopen("/proc/self/statm", "r")) {
+    if (fscanf(statm, "%zu %zu", &pages, &resident) != 2)
+      resident = 0;
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// A query bound to a helper: the setup (global index creation) is not
+// timed, the returned closure is.
+struct Query {
+  std::string name;
+  std::function<std::function<void()>(const DexHelper &, size_t sample)> bind;
+};
+
+std::vector<Query> Queries(const SyntheticDexOptions &options) {
+  auto clazz = [&options](size_t sample) {
+    return SyntheticClassName(sample * 7919 % options.class_count);
+  };
+  auto method = [&options](size_t sample) {
+    return "m" + std::to_string(sample % options.methods_per_class);
+  };
+  auto field = [&options](size_t sample) {
+    return "f" + std::to_string(sample % options.fields_per_class);
+  };
+  auto literal = [&options](size_t sample) {
+    return SyntheticLiteral(sample * 104729 % options.string_count, options);
+  };
+  std::vector<Query> out;
+  out.push_back({"FindMethodUsingString", [=](const DexHelper &h, size_t i) {
+                   return [&h, str = literal(i)] {
+                     h.FindMethodUsingString(str, false, -1, -1, "", -1, {},
+                                             {}, {}, false);
+                   };
+                 }});
+  out.push_back({"FindMethodUsingString first",
+                 [=](const DexHelper &h, size_t i) {
+                   return [&h, str = literal(i)] {
+                     h.FindMethodUsingString(str, false, -1, -1, "", -1, {},
+                                             {}, {}, true);
+                   };
+                 }});
+  out.push_back({"FindMethodUsingString prefix",
+                 [=](const DexHelper &h, size_t i) {
+                   auto str = literal(i);
+                   str.resize(str.find('_') + 3);
+                   return [&h, str] {
+                     h.FindMethodUsingString(str, true, -1, -1, "", -1, {}, {},
+                                             {}, false);
+                   };
+                 }});
+  out.push_back({"FindMethodInvoking", [=](const DexHelper &h, size_t i) {
+                   auto idx = h.CreateMethodIndex(clazz(i), method(i), {});
+                   return [&h, idx] {
+                     h.FindMethodInvoking(idx, -1, -1, "", -1, {}, {}, {},
+                                          false);
+                   };
+                 }});
+  out.push_back({"FindMethodInvoked", [=](const DexHelper &h, size_t i) {
+                   auto idx = h.CreateMethodIndex(clazz(i), method(i), {});
+                   return [&h, idx] {
+                     h.FindMethodInvoked(idx, -1, -1, "", -1, {}, {}, {},
+                                         false);
+                   };
+                 }});
+  out.push_back({"FindMethodInvoked first", [=](const DexHelper &h, size_t i) {
+                   auto idx = h.CreateMethodIndex(clazz(i), method(i), {});
+                   return [&h, idx] {
+                     h.FindMethodInvoked(idx, -1, -1, "", -1, {}, {}, {},
+                                         true);
+                   };
+                 }});
+  out.push_back({"FindMethodGettingField", [=](const DexHelper &h, size_t i) {
+                   auto idx = h.CreateFieldIndex(clazz(i), field(i));
+                   return [&h, idx] {
+                     h.FindMethodGettingField(idx, -1, -1, "", -1, {}, {}, {},
+                                              false);
+                   };
+                 }});
+  out.push_back({"FindMethodSettingField", [=](const DexHelper &h, size_t i) {
+                   auto idx = h.CreateFieldIndex(clazz(i), field(i));
+                   return [&h, idx] {
+                     h.FindMethodSettingField(idx, -1, -1, "", -1, {}, {}, {},
+                                              false);
+                   };
+                 }});
+  out.push_back({"FindField", [=](const DexHelper &h, size_t) {
+                   auto idx = h.CreateClassIndex("I");
+                   return [&h, idx] { h.FindField(idx, {}, false); };
+                 }});
+  return out;
+}
+
+void BenchConstruction(const Config &config, const DexList &dexs) {
+  std::vector<double> ctor, full;
+  std::optional<DexHelper> helper;
+  for (size_t i = 0; i < config.iterations; ++i) {
+    helper.reset();
+    ctor.emplace_back(Time([&] { helper.emplace(dexs, config.helper); }));
+    full.emplace_back(Time([&] { helper->CreateFullCache(); }));
+  }
+  Report("constructor", ctor);
+  Report("CreateFullCache", full);
+
+  if (!config.helper.perf_counters || !helper)
+    return;
+  auto &stats = helper->GetPerfStats();
+  if (!stats.available) {
+    printf("perf counters unavailable\n");
+    return;
+  }
+  Report("perf constructor class_data", stats.class_data, 1);
+  Report("perf constructor method_order", stats.method_order, 1);
+  Report("perf constructor id_caches", stats.id_caches, 1);
+  Report("perf ScanMethod per call", stats.scan, stats.scan_calls);
+}
+
+// code item of every method with code, in method id order
+std::vector<const dex::Code *> MethodCodes(const dex::Reader &dex) {
+  std::vector<const dex::Code *> codes(dex.MethodIds().size());
+  for (auto &class_def : dex.ClassDefs()) {
+    if (class_def.class_data_off == 0)
+      continue;
+    const auto *class_data = dex.Image() + class_def.class_data_off;
+    dex::u4 fields = dex::ReadULeb128(&class_data);
+    fields += dex::ReadULeb128(&class_data);
+    dex::u4 direct_methods = dex::ReadULeb128(&class_data);
+    dex::u4 virtual_methods = dex::ReadULeb128(&class_data);
+    for (dex::u4 i = 0; i < fields; ++i) {
+      dex::ReadULeb128(&class_data);
+      dex::ReadULeb128(&class_data);
+    }
+    for (dex::u4 i = 0, method_idx = 0;
+         i < direct_methods + virtual_methods; ++i) {
+      // the virtual methods restart the index deltas
+      if (i == direct_methods)
+        method_idx = 0;
+      method_idx += dex::ReadULeb128(&class_data);
+      dex::ReadULeb128(&class_data);
+      if (auto offset = dex::ReadULeb128(&class_data))
+        codes[method_idx] =
+            reinterpret_cast<const dex::Code *>(dex.Image() + offset);
+    }
+  }
+  std::erase(codes, nullptr);
+  return codes;
+}
+
+// Reads all bytecode once in method id order and once in code offset
+// order, the order full scans take, evicting the dexes from the caches
+// before each dex: the difference in llc-miss is what the order saves.
+void BenchScanOrder(const DexList &dexs) {
+  if (!perf::Available()) {
+    printf("perf counters unavailable\n");
+    return;
+  }
+  // larger than a last level cache
+  std::vector<char> evict(64 << 20);
+  uint64_t sum = 0;
+  for (bool code_order : {false, true}) {
+    perf::Counters counters;
+    for (auto &[image, size] : dexs) {
+      dex::Reader dex(static_cast<const dex::u1 *>(image), size);
+      auto codes = MethodCodes(dex);
+      if (code_order)
+        std::sort(codes.begin(), codes.end());
+      std::fill(evict.begin(), evict.end(), char(sum));
+      perf::Scope perf(counters);
+      for (auto *code : codes) {
+        for (dex::u4 i = 0; i < code->insns_size; ++i)
+          sum += code->insns[i];
+      }
+    }
+    Report(code_order ? "perf scan in code offset order"
+                      : "perf scan in method id order",
+           counters, 1);
+  }
+  // keeps the reads
+  if (sum == 0)
+    printf("no bytecode\n");
+}
+
+// The decoder ScanMethod had before the opcode table: widths from a
+// hand-written table, the recorded opcodes picked by range checks. Folds
+// every index it would record into sum, weighted by its relations.
+void DecodeWithRanges(const dex::Code &code, uint64_t &sum) {
+  constexpr static uint8_t opcode_len[] = {
+      1, 1, 2, 3, 1, 2, 3, 1, 2, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 3, 2, 2, 3,
+      5, 2, 2, 3, 2, 1, 1, 2, 2, 1, 2, 2, 3, 3, 3, 1, 1, 2, 3, 3, 3, 2, 2, 2,
+      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2,
+      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 1, 3, 3, 3, 3,
+      3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+      2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+      1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
+      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+      1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 4, 3, 3, 2, 2};
+  static_assert(sizeof(opcode_len) == 256);
+  const dex::u2 *inst = code.insns;
+  const dex::u2 *end = code.insns + code.insns_size;
+  while (inst < end) {
+    dex::u1 opcode = *inst & 0xff;
+    if (opcode == 0x1a)
+      sum += uint64_t(inst[1]) * DexHelper::kStringRelation;
+    if (opcode == 0x1b)
+      sum += *reinterpret_cast<const dex::u4 *>(&inst[1]) *
+             uint64_t(DexHelper::kStringRelation);
+    if ((opcode >= 0x52 && opcode <= 0x58) ||
+        (opcode >= 0x60 && opcode <= 0x66))
+      sum += uint64_t(inst[1]) * DexHelper::kGettingRelation;
+    if ((opcode >= 0x59 && opcode <= 0x5f) ||
+        (opcode >= 0x67 && opcode <= 0x6d))
+      sum += uint64_t(inst[1]) * DexHelper::kSettingRelation;
+    if ((opcode >= 0x74 && opcode <= 0x78) ||
+        (opcode >= 0x6e && opcode <= 0x72))
+      sum += uint64_t(inst[1]) *
+             (DexHelper::kInvokingRelation | DexHelper::kInvokedRelation);
+    if (opcode == 0x00) {
+      if (*inst == 0x0100) {
+        inst += inst[1] * 2 + 3;
+      } else if (*inst == 0x0200) {
+        inst += inst[1] * 4 + 1;
+      } else if (*inst == 0x0300) {
+        inst +=
+            (*reinterpret_cast<const dex::u4 *>(&inst[2]) * inst[1] + 1) / 2 +
+            3;
+      }
+    }
+    inst += opcode_len[opcode];
+  }
+}
+
+// the same through the opcode table ScanMethod decodes with now
+void DecodeWithTable(const dex::Code &code, uint64_t &sum) {
+  const dex::u2 *inst = code.insns;
+  const dex::u2 *end = code.insns + code.insns_size;
+  while (inst < end) {
+    auto &info = dex_opcodes::kOpcodes[*inst & 0xff];
+    if (info.relations)
+      sum += uint64_t(dex_opcodes::Operand(inst, info)) * info.relations;
+    inst = dex_opcodes::NextInstruction(inst, info);
+  }
+}
+
+// Before and after of the opcode table: decodes all bytecode with each
+// decoder, without the posting list inserts that dominate CreateFullCache.
+void BenchDecoder(const Config &config, const DexList &dexs) {
+  std::vector<const dex::Code *> codes;
+  for (auto &[image, size] : dexs) {
+    dex::Reader dex(static_cast<const dex::u1 *>(image), size);
+    auto dex_codes = MethodCodes(dex);
+    std::sort(dex_codes.begin(), dex_codes.end());
+    codes.insert(codes.end(), dex_codes.begin(), dex_codes.end());
+  }
+  bool perf = config.helper.perf_counters && perf::Available();
+  uint64_t sums[2] = {};
+  for (bool table : {false, true}) {
+    std::vector<double> ms;
+    perf::Counters counters;
+    for (size_t i = 0; i < config.samples; ++i) {
+      uint64_t sum = 0;
+      ms.emplace_back(Time([&] {
+        perf::Scope scope(counters, perf);
+        for (auto *code : codes) {
+          if (table)
+            DecodeWithTable(*code, sum);
+          else
+            DecodeWithRanges(*code, sum);
+        }
+      }));
+      sums[table] = sum;
+    }
+    Report(table ? "decode opcode table" : "decode range checks", ms);
+    if (perf)
+      Report(table ? "perf decode opcode table" : "perf decode range checks",
+             counters, config.samples);
+  }
+  if (sums[0] != sums[1])
+    printf("decoders disagree: %llu != %llu\n",
+           (unsigned long long)sums[0], (unsigned long long)sums[1]);
+}
+
+void BenchQueries(const Config &config, const DexList &dexs) {
+  auto queries = Queries(config.dex);
+  DexHelper::ResetGlobalQueryStats();
+  for (auto &query : queries) {
+    std::vector<double> ms;
+    for (size_t i = 0; i < config.samples; ++i) {
+      DexHelper helper(dexs, config.helper);
+      auto run = query.bind(helper, i);
+      ms.emplace_back(Time(run));
+    }
+    Report("cold " + query.name, ms);
+  }
+  if (config.helper.perf_counters && perf::Available())
+    ReportQueryCounters("perf cold ");
+
+  DexHelper helper(dexs, config.helper);
+  helper.CreateFullCache();
+  DexHelper::ResetGlobalQueryStats();
+  for (auto &query : queries) {
+    std::vector<double> ms;
+    for (size_t i = 0; i < config.samples; ++i) {
+      auto run = query.bind(helper, i);
+      ms.emplace_back(Time(run));
+    }
+    Report("warm " + query.name, ms);
+  }
+  if (config.helper.perf_counters && perf::Available())
+    ReportQueryCounters("perf warm ");
+}
+
+// Class index creation and missing prefixes, both mostly string search:
+// compare pools with --unicode=0 and higher.
+void BenchStringLookup(const Config &config, const DexList &dexs) {
+  constexpr size_t kLookups = 1000;
+  std::vector<std::string> classes, prefixes;
+  for (size_t i = 0; i < kLookups; ++i) {
+    classes.emplace_back(
+        SyntheticClassName(i * 7919 % config.dex.class_count));
+    prefixes.emplace_back(
+        SyntheticLiteral(i * 104729 % config.dex.string_count, config.dex) +
+        "~");
+  }
+  DexHelper helper(dexs, config.helper);
+  std::vector<double> class_ms, prefix_ms;
+  for (size_t i = 0; i < config.samples; ++i) {
+    class_ms.emplace_back(Time([&] {
+      for (auto &name : classes)
+        helper.CreateClassIndex(name);
+    }));
+    prefix_ms.emplace_back(Time([&] {
+      for (auto &prefix : prefixes)
+        helper.FindMethodUsingString(prefix, true, -1, -1, "", -1, {}, {}, {},
+                                     false);
+    }));
+  }
+  Report("string lookup CreateClassIndex x1000", class_ms);
+  Report("string lookup missing prefix x1000", prefix_ms);
+  // the lookups above are what materializes the strings, once per dex
+  if (helper.GetPerfStats().available)
+    Report("perf string materialization", helper.GetPerfStats().strings, 1);
+}
+
+void BenchMemory(const DexList &dexs) {
+  auto rss = RssBytes();
+  DexHelper helper(dexs);
+  Report("rss after constructor", (RssBytes() - rss) / 1024.0, "KiB");
+  auto stats = helper.MemoryStats();
+  Report("tables after constructor", stats.capacity / 1024.0, "KiB");
+  helper.CreateFullCache();
+  Report("rss after CreateFullCache", (RssBytes() - rss) / 1024.0, "KiB");
+  stats = helper.MemoryStats();
+  Report("tables after CreateFullCache", stats.capacity / 1024.0, "KiB");
+  for (auto &table : stats.tables) {
+    Report(std::string("  ") + table.name, table.capacity / 1024.0, "KiB");
+  }
+
+  DexHelper strings_only(
+      dexs, DexHelper::Options{.relations = DexHelper::kStringRelation});
+  strings_only.CreateFullCache();
+  Report("tables after string-only CreateFullCache",
+         strings_only.MemoryStats().capacity / 1024.0, "KiB");
+}
+
+std::vector<std::string>
+WriteDexes(const std::string &dir,
+           const std::vector<std::vector<dex::u1>> &images) {
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < images.size(); ++i) {
+    auto path = dir + "/classes" + (i ? std::to_string(i + 1) : "") + ".dex";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || write(fd, images[i].data(), images[i].size()) !=
+                        ssize_t(images[i].size())) {
+      perror(path.c_str());
+      exit(1);
+    }
+    fdatasync(fd);
+    close(fd);
+    paths.emplace_back(path);
+  }
+  return paths;
+}
+
+// Maps the dex files after dropping them from the page cache, so every
+// first touch is a major fault unless something read it ahead.
+void BenchColdPageCache(const std::vector<std::string> &paths) {
+  for (bool prefetch : {false, true}) {
+    DexList dexs;
+    for (auto &path : paths) {
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat s {};
+      fstat(fd, &s);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      dexs.emplace_back(
+          mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0), s.st_size);
+      close(fd);
+    }
+    {
+      std::string prefix = prefetch ? "cold mmap prefetch " : "cold mmap ";
+      std::optional<DexHelper> helper;
+      Report(prefix + "constructor", {Time([&] {
+               helper.emplace(dexs, DexHelper::Options{.prefetch = prefetch});
+             })});
+      Report(prefix + "CreateFullCache",
+             {Time([&] { helper->CreateFullCache(); })});
+      auto &stats = helper->GetPrefetchStats();
+      Report(prefix + "major faults strings", stats.strings.major_faults, "");
+      Report(prefix + "major faults class_data", stats.class_data.major_faults,
+             "");
+      Report(prefix + "major faults code", stats.code.major_faults, "");
+    }
+    for (auto &[image, size] : dexs) {
+      munmap(const_cast<void *>(image), size);
+    }
+  }
+}
+
+bool ParseArgs(int argc, char *argv[], Config &config) {
+  struct Flag {
+    std::string_view name;
+    size_t *value;
+  } flags[] = {
+      {"--dexes=", &config.dex.dex_count},
+      {"--classes=", &config.dex.class_count},
+      {"--methods=", &config.dex.methods_per_class},
+      {"--fields=", &config.dex.fields_per_class},
+      {"--strings=", &config.dex.string_count},
+      {"--invoke-density=", &config.dex.invoke_density},
+      {"--string-density=", &config.dex.string_density},
+      {"--field-density=", &config.dex.field_density},
+      {"--cross-dex=", &config.dex.cross_dex_percent},
+      {"--unicode=", &config.dex.unicode_percent},
+      {"--iterations=", &config.iterations},
+      {"--samples=", &config.samples},
+  };
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    bool known = false;
+    for (auto &flag : flags) {
+      if (arg.substr(0, flag.name.size()) == flag.name) {
+        *flag.value = std::strtoull(argv[i] + flag.name.size(), nullptr, 10);
+        known = true;
+      }
+    }
+    if (arg.substr(0, 7) == "--seed=") {
+      config.dex.seed = std::strtoull(argv[i] + 7, nullptr, 10);
+    } else if (arg.substr(0, 6) == "--dir=") {
+      config.dir = arg.substr(6);
+    } else if (arg == "--perf") {
+      config.helper.perf_counters = true;
+    } else if (arg.substr(0, 8) == "--write=") {
+      config.dir = arg.substr(8);
+      config.write_only = true;
+    } else if (!known) {
+      fprintf(stderr,
+              "usage: %s [--dexes=N] [--classes=N] [--methods=N] "
+              "[--fields=N] [--strings=N] [--invoke-density=N] "
+              "[--string-density=N] [--field-density=N] [--cross-dex=PCT] "
+              "[--unicode=PCT] [--seed=N] [--iterations=N] [--samples=N] "
+              "[--dir=DIR] [--write=DIR] [--perf]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return config.dex.dex_count && config.dex.class_count &&
+         config.dex.methods_per_class && config.dex.fields_per_class &&
+         config.dex.string_count;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Config config;
+  if (!ParseArgs(argc, argv, config))
+    return 1;
+
+  std::vector<std::vector<dex::u1>> images;
+  Report("generate",
+         {Time([&] { images = GenerateSyntheticDexes(config.dex); })});
+  if (config.write_only) {
+    WriteDexes(config.dir, images);
+    return 0;
+  }
+  size_t total = 0;
+  DexList dexs;
+  for (auto &image : images) {
+    dexs.emplace_back(image.data(), image.size());
+    total += image.size();
+  }
+  Report("dex bytes", total / 1024.0, "KiB");
+
+  BenchConstruction(config, dexs);
+  if (config.helper.perf_counters)
+    BenchScanOrder(dexs);
+  BenchDecoder(config, dexs);
+  BenchQueries(config, dexs);
+  BenchStringLookup(config, dexs);
+  BenchMemory(dexs);
+
+  bool temp_dir = config.dir.empty();
+  if (temp_dir) {
+    char pattern[] = "/tmp/dexhelper-bench-XXXXXX";
+    if (!mkdtemp(pattern)) {
+      perror("mkdtemp");
+      return 1;
+    }
+    config.dir = pattern;
+  }
+  auto paths = WriteDexes(config.dir, images);
+  BenchColdPageCache(paths);
+  if (temp_dir) {
+    for (auto &path : paths)
+      unlink(path.c_str());
+    rmdir(config.dir.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,740 @@
+#include "slicer/buffer.h"
+#include "slicer/dex_format.h"
+#include "slicer/dex_utf8.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <string>
+#include <tuple>
+
+#include "dex_generator.h"
+
+namespace {
+
+// splitmix64, so the output only depends on the options
+struct Random {
+  uint64_t state;
+  uint64_t Next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  size_t Below(size_t bound) { return bound ? Next() % bound : 0; }
+  // roughly centered at mean
+  size_t Around(size_t mean) { return Below(mean * 2 + 1); }
+};
+
+struct Proto {
+  std::string return_type;
+  std::vector<std::string> params;
+};
+
+const Proto kProtos[] = {
+    {"V", {}},
+    {"V", {"I"}},
+    {"V", {"Ljava/lang/String;"}},
+    {"I", {}},
+    {"I", {"I", "I"}},
+    {"Ljava/lang/String;", {"Ljava/lang/String;"}},
+    {"Z", {"Ljava/lang/Object;", "I"}},
+    {"J", {"J"}},
+    {"Ljava/lang/Object;", {}},
+    {"V", {"Landroid/content/Context;", "Ljava/lang/String;"}},
+    {"Ljava/lang/StringBuilder;", {"Ljava/lang/String;"}},
+    {"I", {"Ljava/lang/String;", "Ljava/lang/String;"}},
+};
+constexpr size_t kProtoCount = sizeof(kProtos) / sizeof(kProtos[0]);
+// protos only used by the framework references below
+constexpr size_t kAppProtoCount = 10;
+
+struct MethodRef {
+  std::string owner;
+  std::string name;
+  size_t proto;
+  bool is_static;
+  auto Key() const { return std::tie(owner, name, proto); }
+  bool operator<(const MethodRef &o) const { return Key() < o.Key(); }
+};
+
+struct FieldRef {
+  std::string owner;
+  std::string name;
+  std::string type;
+  bool is_static;
+  auto Key() const { return std::tie(owner, name, type); }
+  bool operator<(const FieldRef &o) const { return Key() < o.Key(); }
+};
+
+const MethodRef kFrameworkMethods[] = {
+    {"Ljava/lang/Object;", "<init>", 0, false},
+    {"Ljava/lang/StringBuilder;", "append", 10, false},
+    {"Landroid/util/Log;", "d", 11, true},
+};
+
+const char *const kWords[] = {
+    "network", "request", "response", "user",   "config", "cache",
+    "login",   "token",   "session",  "upload", "stream", "payload",
+    "module",  "hook",    "service",  "bridge", "event",  "render",
+};
+constexpr size_t kWordCount = sizeof(kWords) / sizeof(kWords[0]);
+
+const char *const kFieldTypes[] = {"I", "J", "Z", "Ljava/lang/String;",
+                                   "Ljava/lang/Object;"};
+constexpr size_t kFieldTypeCount = sizeof(kFieldTypes) / sizeof(kFieldTypes[0]);
+
+std::string FieldType(size_t class_idx, size_t field_idx) {
+  auto kind = (class_idx * 7 + field_idx * 3) % (kFieldTypeCount + 1);
+  if (kind == kFieldTypeCount)
+    return SyntheticClassName(class_idx / 2);
+  return kFieldTypes[kind];
+}
+
+size_t MethodProto(size_t class_idx, size_t method_idx) {
+  return (class_idx * 5 + method_idx * 3) % kAppProtoCount;
+}
+
+char Shorty(const std::string &descriptor) {
+  return descriptor[0] == '[' ? 'L' : descriptor[0];
+}
+
+size_t AccessWidth(const std::string &type) {
+  switch (type[0]) {
+  case 'J':
+    return 1;
+  case 'Z':
+    return 3;
+  case 'L':
+  case '[':
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+enum InsnKind : dex::u1 {
+  kPlain,
+  kString,
+  kMethod,
+  kField,
+  kSwitch,
+  kArray,
+};
+
+struct Insn {
+  dex::u1 opcode;
+  InsnKind kind;
+  size_t ref;
+};
+
+struct MethodSpec {
+  MethodRef ref;
+  std::vector<Insn> body;
+};
+
+struct ClassSpec {
+  std::string name;
+  std::vector<FieldRef> fields;
+  std::vector<MethodSpec> methods;
+};
+
+class Sha1 {
+public:
+  void Update(const dex::u1 *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      block_[block_len_++] = data[i];
+      if (block_len_ == 64) {
+        Compress();
+        block_len_ = 0;
+      }
+    }
+    total_ += size;
+  }
+
+  void Final(dex::u1 *out) {
+    uint64_t bits = total_ * 8;
+    dex::u1 pad = 0x80;
+    Update(&pad, 1);
+    pad = 0;
+    while (block_len_ != 56)
+      Update(&pad, 1);
+    for (int i = 7; i >= 0; --i) {
+      dex::u1 b = bits >> (i * 8);
+      Update(&b, 1);
+    }
+    for (int i = 0; i < 5; ++i) {
+      for (int j = 0; j < 4; ++j)
+        out[i * 4 + j] = h_[i] >> (24 - j * 8);
+    }
+  }
+
+private:
+  static uint32_t Rol(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+  void Compress() {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = uint32_t(block_[i * 4]) << 24 | uint32_t(block_[i * 4 + 1]) << 16 |
+             uint32_t(block_[i * 4 + 2]) << 8 | block_[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i)
+      w[i] = Rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      uint32_t t = Rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = Rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h_[0] += a;
+    h_[1] += b;
+    h_[2] += c;
+    h_[3] += d;
+    h_[4] += e;
+  }
+
+  uint32_t h_[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                    0xc3d2e1f0};
+  dex::u1 block_[64];
+  size_t block_len_ = 0;
+  uint64_t total_ = 0;
+};
+
+class DexBuilder {
+public:
+  DexBuilder(const SyntheticDexOptions &options, size_t dex_idx)
+      : options_(options), dex_idx_(dex_idx) {}
+
+  std::vector<dex::u1> Build();
+
+private:
+  size_t ClassBegin(size_t dex_idx) const {
+    return dex_idx * options_.class_count / options_.dex_count;
+  }
+
+  size_t InternString(const std::string &str) {
+    return literals_.emplace(str, literals_.size()).first->second;
+  }
+  size_t InternMethod(const MethodRef &ref) {
+    return method_refs_.emplace(ref, method_refs_.size()).first->second;
+  }
+  size_t InternField(const FieldRef &ref) {
+    return field_refs_.emplace(ref, field_refs_.size()).first->second;
+  }
+
+  MethodRef AppMethod(size_t class_idx, size_t method_idx) const {
+    return {SyntheticClassName(class_idx), "m" + std::to_string(method_idx),
+            MethodProto(class_idx, method_idx), method_idx % 2 == 0};
+  }
+  FieldRef AppField(size_t class_idx, size_t field_idx) const {
+    return {SyntheticClassName(class_idx), "f" + std::to_string(field_idx),
+            FieldType(class_idx, field_idx), field_idx % 2 == 0};
+  }
+
+  void GenerateClasses();
+  std::vector<Insn> GenerateBody(Random &rng, size_t class_idx);
+  std::vector<dex::u2> Encode(const std::vector<Insn> &body) const;
+
+  const SyntheticDexOptions &options_;
+  size_t dex_idx_;
+
+  std::vector<ClassSpec> classes_;
+  std::map<std::string, size_t> literals_;
+  std::map<MethodRef, size_t> method_refs_;
+  std::map<FieldRef, size_t> field_refs_;
+
+  // resolved ids, valid after Build() sorted the pools
+  std::vector<uint32_t> literal_ids_;
+  std::vector<uint32_t> method_ids_;
+  std::vector<uint32_t> field_ids_;
+};
+
+void DexBuilder::GenerateClasses() {
+  for (size_t class_idx = ClassBegin(dex_idx_);
+       class_idx < ClassBegin(dex_idx_ + 1); ++class_idx) {
+    ClassSpec clazz{
+        .name = SyntheticClassName(class_idx), .fields = {}, .methods = {}};
+    for (size_t i = 0; i < options_.fields_per_class; ++i) {
+      clazz.fields.emplace_back(AppField(class_idx, i));
+      InternField(clazz.fields.back());
+    }
+    for (size_t i = 0; i < options_.methods_per_class; ++i) {
+      Random rng{options_.seed ^ (class_idx << 20) ^ i};
+      MethodSpec method{.ref = AppMethod(class_idx, i), .body = {}};
+      InternMethod(method.ref);
+      method.body = GenerateBody(rng, class_idx);
+      clazz.methods.emplace_back(std::move(method));
+    }
+    classes_.emplace_back(std::move(clazz));
+  }
+}
+
+std::vector<Insn> DexBuilder::GenerateBody(Random &rng, size_t class_idx) {
+  std::vector<Insn> body;
+  size_t strings = rng.Around(options_.string_density);
+  size_t invokes = rng.Around(options_.invoke_density);
+  size_t fields = options_.fields_per_class ? rng.Around(options_.field_density)
+                                            : 0;
+  size_t begin = ClassBegin(dex_idx_), end = ClassBegin(dex_idx_ + 1);
+  while (strings + invokes + fields > 0) {
+    auto pick = rng.Below(strings + invokes + fields);
+    if (pick < strings) {
+      --strings;
+      auto literal = rng.Below(options_.string_count);
+      body.push_back({0x1a, kString,
+                      InternString(SyntheticLiteral(literal, options_))});
+    } else if (pick < strings + invokes) {
+      --invokes;
+      MethodRef target;
+      auto roll = rng.Below(100);
+      if (roll < 10 || options_.methods_per_class == 0) {
+        target = kFrameworkMethods[rng.Below(std::size(kFrameworkMethods))];
+      } else {
+        size_t callee_class = begin + rng.Below(end - begin);
+        if (options_.dex_count > 1 && roll < 10 + options_.cross_dex_percent)
+          callee_class = rng.Below(options_.class_count);
+        target = AppMethod(callee_class,
+                           rng.Below(options_.methods_per_class));
+      }
+      dex::u1 opcode = target.is_static ? 0x71 : 0x6e;
+      if (target.name == "<init>")
+        opcode = 0x70;
+      if (rng.Below(8) == 0)
+        opcode += 0x06; // the /range variant
+      body.push_back({opcode, kMethod, InternMethod(target)});
+    } else {
+      --fields;
+      size_t owner = rng.Below(4) ? class_idx : begin + rng.Below(end - begin);
+      auto field = AppField(owner, rng.Below(options_.fields_per_class));
+      bool put = rng.Below(3) == 0;
+      dex::u1 opcode = field.is_static ? (put ? 0x67 : 0x60)
+                                       : (put ? 0x59 : 0x52);
+      opcode += AccessWidth(field.type);
+      body.push_back({opcode, kField, InternField(field)});
+    }
+    // some arithmetic and control flow filler
+    switch (rng.Below(8)) {
+    case 0:
+      body.push_back({0x90, kPlain, 0}); // add-int
+      break;
+    case 1:
+      body.push_back({0x38, kPlain, 0}); // if-eqz
+      break;
+    case 2:
+      body.push_back({0x12, kPlain, 0}); // const/4
+      break;
+    default:
+      break;
+    }
+  }
+  if (rng.Below(16) == 0)
+    body.push_back({0x2b, kSwitch, rng.Below(6) + 1});
+  if (rng.Below(16) == 0)
+    body.push_back({0x26, kArray, rng.Below(9) + 1});
+  body.push_back({0x0e, kPlain, 0}); // return-void
+  return body;
+}
+
+std::vector<dex::u2> DexBuilder::Encode(const std::vector<Insn> &body) const {
+  std::vector<dex::u2> code;
+  // (instruction position, payload insn) pairs to patch
+  std::vector<std::tuple<size_t, const Insn *>> payloads;
+  for (auto &insn : body) {
+    switch (insn.kind) {
+    case kPlain:
+      if (insn.opcode == 0x90) {
+        code.insert(code.end(), {dex::u2(insn.opcode), 0x0201});
+      } else if (insn.opcode == 0x38) {
+        code.insert(code.end(), {dex::u2(insn.opcode), 2});
+      } else {
+        code.push_back(insn.opcode);
+      }
+      break;
+    case kString:
+      if (auto id = literal_ids_[insn.ref]; id > 0xffff) {
+        code.insert(code.end(),
+                    {0x1b, dex::u2(id & 0xffff), dex::u2(id >> 16)});
+      } else {
+        code.insert(code.end(), {0x1a, dex::u2(id)});
+      }
+      break;
+    case kMethod:
+      if (insn.opcode >= 0x74) {
+        code.insert(code.end(), {dex::u2(insn.opcode | 0x0100),
+                                 dex::u2(method_ids_[insn.ref]), 0});
+      } else {
+        code.insert(code.end(), {dex::u2(insn.opcode | 0x1000),
+                                 dex::u2(method_ids_[insn.ref]), 0});
+      }
+      break;
+    case kField:
+      if (insn.opcode >= 0x60) {
+        code.insert(code.end(),
+                    {dex::u2(insn.opcode), dex::u2(field_ids_[insn.ref])});
+      } else {
+        code.insert(code.end(), {dex::u2(insn.opcode | 0x1000),
+                                 dex::u2(field_ids_[insn.ref])});
+      }
+      break;
+    case kSwitch:
+    case kArray:
+      payloads.emplace_back(code.size(), &insn);
+      code.insert(code.end(), {dex::u2(insn.opcode), 0, 0});
+      break;
+    }
+  }
+  for (auto &[pos, insn] : payloads) {
+    if (code.size() % 2)
+      code.push_back(0); // payloads are 4-byte aligned
+    auto rel = dex::u4(code.size() - pos);
+    code[pos + 1] = rel & 0xffff;
+    code[pos + 2] = rel >> 16;
+    auto count = dex::u2(insn->ref);
+    if (insn->kind == kSwitch) {
+      // packed-switch-payload, all targets fall through to the next insn
+      code.insert(code.end(), {0x0100, count, 0, 0});
+      for (dex::u2 i = 0; i < count; ++i)
+        code.insert(code.end(), {3, 0});
+    } else {
+      // fill-array-data-payload of count 1-byte elements
+      code.insert(code.end(), {0x0300, 1, count, 0});
+      code.insert(code.end(), (count + 1) / 2, 0x5a5a);
+    }
+  }
+  return code;
+}
+
+std::vector<dex::u1> DexBuilder::Build() {
+  GenerateClasses();
+
+  // the full string pool
+  std::map<std::string, size_t> all_strings;
+  std::map<std::string, size_t> all_types;
+  auto add_type = [&](const std::string &type) {
+    all_types.emplace(type, 0);
+    all_strings.emplace(type, 0);
+  };
+  for (auto &[literal, _] : literals_)
+    all_strings.emplace(literal, 0);
+  add_type("Ljava/lang/Object;");
+  std::vector<bool> proto_used(kProtoCount);
+  for (auto &[ref, _] : method_refs_) {
+    add_type(ref.owner);
+    all_strings.emplace(ref.name, 0);
+    proto_used[ref.proto] = true;
+  }
+  for (auto &[ref, _] : field_refs_) {
+    add_type(ref.owner);
+    add_type(ref.type);
+    all_strings.emplace(ref.name, 0);
+  }
+  std::vector<std::string> shorties(kProtoCount);
+  for (size_t i = 0; i < kProtoCount; ++i) {
+    if (!proto_used[i])
+      continue;
+    shorties[i] = Shorty(kProtos[i].return_type);
+    add_type(kProtos[i].return_type);
+    for (auto &param : kProtos[i].params) {
+      shorties[i] += Shorty(param);
+      add_type(param);
+    }
+    all_strings.emplace(shorties[i], 0);
+  }
+
+  std::vector<std::string> strings;
+  for (auto &[str, _] : all_strings)
+    strings.emplace_back(str);
+  // the dex string pool is ordered by UTF-16 code points
+  std::sort(strings.begin(), strings.end(), [](auto &a, auto &b) {
+    return dex::Utf8Cmp(a.c_str(), b.c_str()) < 0;
+  });
+  for (size_t i = 0; i < strings.size(); ++i)
+    all_strings[strings[i]] = i;
+
+  std::vector<std::string> types;
+  for (auto &[type, _] : all_types)
+    types.emplace_back(type);
+  std::sort(types.begin(), types.end(), [&](auto &a, auto &b) {
+    return all_strings[a] < all_strings[b];
+  });
+  for (size_t i = 0; i < types.size(); ++i)
+    all_types[types[i]] = i;
+
+  // protos sorted by return type, then by parameter types
+  std::vector<std::tuple<uint32_t, std::vector<uint32_t>, size_t>> protos;
+  for (size_t i = 0; i < kProtoCount; ++i) {
+    if (!proto_used[i])
+      continue;
+    std::vector<uint32_t> params;
+    for (auto &param : kProtos[i].params)
+      params.emplace_back(all_types[param]);
+    protos.emplace_back(all_types[kProtos[i].return_type], std::move(params),
+                        i);
+  }
+  std::sort(protos.begin(), protos.end());
+  std::vector<uint32_t> proto_ids(kProtoCount, dex::kNoIndex);
+  for (size_t i = 0; i < protos.size(); ++i)
+    proto_ids[std::get<2>(protos[i])] = i;
+
+  std::vector<std::tuple<uint32_t, uint32_t, uint32_t, size_t>> fields;
+  for (auto &[ref, slot] : field_refs_) {
+    fields.emplace_back(all_types[ref.owner], all_strings[ref.name],
+                        all_types[ref.type], slot);
+  }
+  std::sort(fields.begin(), fields.end());
+  field_ids_.resize(fields.size());
+  for (size_t i = 0; i < fields.size(); ++i)
+    field_ids_[std::get<3>(fields[i])] = i;
+
+  std::vector<std::tuple<uint32_t, uint32_t, uint32_t, size_t>> methods;
+  for (auto &[ref, slot] : method_refs_) {
+    methods.emplace_back(all_types[ref.owner], all_strings[ref.name],
+                         proto_ids[ref.proto], slot);
+  }
+  std::sort(methods.begin(), methods.end());
+  method_ids_.resize(methods.size());
+  for (size_t i = 0; i < methods.size(); ++i)
+    method_ids_[std::get<3>(methods[i])] = i;
+
+  literal_ids_.resize(literals_.size());
+  for (auto &[literal, slot] : literals_)
+    literal_ids_[slot] = all_strings[literal];
+
+  slicer::Buffer image;
+  image.Alloc(sizeof(dex::Header));
+  auto string_ids_off = image.Alloc(strings.size() * sizeof(dex::StringId));
+  auto type_ids_off = image.Alloc(types.size() * sizeof(dex::TypeId));
+  auto proto_ids_off = image.Alloc(protos.size() * sizeof(dex::ProtoId));
+  auto field_ids_off = image.Alloc(fields.size() * sizeof(dex::FieldId));
+  auto method_ids_off = image.Alloc(methods.size() * sizeof(dex::MethodId));
+  auto class_defs_off = image.Alloc(classes_.size() * sizeof(dex::ClassDef));
+
+  image.Align(4);
+  auto data_off = image.size();
+
+  // code items, in class definition order like d8 lays them out
+  std::vector<std::vector<dex::u4>> code_offs;
+  size_t code_count = 0;
+  for (auto &clazz : classes_) {
+    auto &offs = code_offs.emplace_back();
+    for (auto &method : clazz.methods) {
+      auto insns = Encode(method.body);
+      image.Align(4);
+      dex::Code code{.registers_size = 3,
+                     .ins_size = 0,
+                     .outs_size = 1,
+                     .tries_size = 0,
+                     .debug_info_off = 0,
+                     .insns_size = dex::u4(insns.size())};
+      offs.emplace_back(image.Push(&code, sizeof(code)));
+      image.Push(insns);
+      ++code_count;
+    }
+  }
+
+  image.Align(4);
+  auto type_lists_off = image.size();
+  size_t type_list_count = 0;
+  std::vector<dex::u4> param_offs(protos.size());
+  for (size_t i = 0; i < protos.size(); ++i) {
+    auto &params = std::get<1>(protos[i]);
+    if (params.empty())
+      continue;
+    image.Align(4);
+    param_offs[i] = image.Push(dex::u4(params.size()));
+    for (auto type : params)
+      image.Push(dex::u2(type));
+    ++type_list_count;
+  }
+
+  auto string_data_off = image.size();
+  std::vector<dex::u4> string_offs;
+  for (auto &str : strings) {
+    size_t utf16_len = 0;
+    for (unsigned char c : str)
+      utf16_len += (c & 0xc0) != 0x80;
+    string_offs.emplace_back(image.PushULeb128(utf16_len));
+    image.Push(str.data(), str.size() + 1);
+  }
+
+  auto class_data_off = image.size();
+  std::vector<dex::u4> class_data_offs;
+  for (size_t c = 0; c < classes_.size(); ++c) {
+    auto &clazz = classes_[c];
+    std::vector<uint32_t> static_fields, instance_fields;
+    for (auto &field : clazz.fields) {
+      (field.is_static ? static_fields : instance_fields)
+          .emplace_back(field_ids_[field_refs_[field]]);
+    }
+    std::vector<std::tuple<uint32_t, dex::u4>> direct, virtuals;
+    for (size_t m = 0; m < clazz.methods.size(); ++m) {
+      auto &ref = clazz.methods[m].ref;
+      (ref.is_static ? direct : virtuals)
+          .emplace_back(method_ids_[method_refs_[ref]], code_offs[c][m]);
+    }
+    std::sort(static_fields.begin(), static_fields.end());
+    std::sort(instance_fields.begin(), instance_fields.end());
+    std::sort(direct.begin(), direct.end());
+    std::sort(virtuals.begin(), virtuals.end());
+
+    class_data_offs.emplace_back(image.PushULeb128(static_fields.size()));
+    image.PushULeb128(instance_fields.size());
+    image.PushULeb128(direct.size());
+    image.PushULeb128(virtuals.size());
+    for (auto *list : {&static_fields, &instance_fields}) {
+      uint32_t prev = 0;
+      for (auto field_id : *list) {
+        image.PushULeb128(field_id - prev);
+        image.PushULeb128(dex::kAccPublic | (list == &static_fields
+                                                 ? dex::kAccStatic
+                                                 : 0));
+        prev = field_id;
+      }
+    }
+    for (auto *list : {&direct, &virtuals}) {
+      uint32_t prev = 0;
+      for (auto &[method_id, code_off] : *list) {
+        image.PushULeb128(method_id - prev);
+        image.PushULeb128(dex::kAccPublic |
+                          (list == &direct ? dex::kAccStatic : 0));
+        image.PushULeb128(code_off);
+        prev = method_id;
+      }
+    }
+  }
+
+  image.Align(4);
+  std::vector<dex::MapItem> map;
+  auto add_map = [&](dex::u2 type, size_t size, size_t offset) {
+    if (size)
+      map.push_back({type, 0, dex::u4(size), dex::u4(offset)});
+  };
+  add_map(dex::kHeaderItem, 1, 0);
+  add_map(dex::kStringIdItem, strings.size(), string_ids_off);
+  add_map(dex::kTypeIdItem, types.size(), type_ids_off);
+  add_map(dex::kProtoIdItem, protos.size(), proto_ids_off);
+  add_map(dex::kFieldIdItem, fields.size(), field_ids_off);
+  add_map(dex::kMethodIdItem, methods.size(), method_ids_off);
+  add_map(dex::kClassDefItem, classes_.size(), class_defs_off);
+  add_map(dex::kCodeItem, code_count, data_off);
+  add_map(dex::kTypeList, type_list_count, type_lists_off);
+  add_map(dex::kStringDataItem, strings.size(), string_data_off);
+  add_map(dex::kClassDataItem, classes_.size(), class_data_off);
+  auto map_off = image.Push(dex::u4(map.size() + 1));
+  add_map(dex::kMapList, 1, map_off);
+  image.Push(map);
+
+  // patch the index sections
+  for (size_t i = 0; i < strings.size(); ++i)
+    image.ptr<dex::StringId>(string_ids_off)[i] = {string_offs[i]};
+  for (size_t i = 0; i < types.size(); ++i) {
+    image.ptr<dex::TypeId>(type_ids_off)[i] = {
+        dex::u4(all_strings[types[i]])};
+  }
+  for (size_t i = 0; i < protos.size(); ++i) {
+    auto &[return_type, _, proto] = protos[i];
+    image.ptr<dex::ProtoId>(proto_ids_off)[i] = {
+        dex::u4(all_strings[shorties[proto]]), return_type, param_offs[i]};
+  }
+  for (size_t i = 0; i < fields.size(); ++i) {
+    auto &[owner, name, type, _] = fields[i];
+    image.ptr<dex::FieldId>(field_ids_off)[i] = {dex::u2(owner), dex::u2(type),
+                                                 name};
+  }
+  for (size_t i = 0; i < methods.size(); ++i) {
+    auto &[owner, name, proto, _] = methods[i];
+    image.ptr<dex::MethodId>(method_ids_off)[i] = {dex::u2(owner),
+                                                   dex::u2(proto), name};
+  }
+  for (size_t i = 0; i < classes_.size(); ++i) {
+    image.ptr<dex::ClassDef>(class_defs_off)[i] = {
+        .class_idx = dex::u4(all_types[classes_[i].name]),
+        .access_flags = dex::kAccPublic,
+        .superclass_idx = dex::u4(all_types["Ljava/lang/Object;"]),
+        .interfaces_off = 0,
+        .source_file_idx = dex::kNoIndex,
+        .annotations_off = 0,
+        .class_data_off = class_data_offs[i],
+        .static_values_off = 0,
+    };
+  }
+
+  auto *header = image.ptr<dex::Header>(0);
+  std::memcpy(header->magic, "dex\n035", 8);
+  header->file_size = image.size();
+  header->header_size = sizeof(dex::Header);
+  header->endian_tag = dex::kEndianConstant;
+  header->map_off = map_off;
+  header->string_ids_size = strings.size();
+  header->string_ids_off = strings.empty() ? 0 : string_ids_off;
+  header->type_ids_size = types.size();
+  header->type_ids_off = types.empty() ? 0 : type_ids_off;
+  header->proto_ids_size = protos.size();
+  header->proto_ids_off = protos.empty() ? 0 : proto_ids_off;
+  header->field_ids_size = fields.size();
+  header->field_ids_off = fields.empty() ? 0 : field_ids_off;
+  header->method_ids_size = methods.size();
+  header->method_ids_off = methods.empty() ? 0 : method_ids_off;
+  header->class_defs_size = classes_.size();
+  header->class_defs_off = classes_.empty() ? 0 : class_defs_off;
+  header->data_off = data_off;
+  header->data_size = image.size() - data_off;
+
+  std::vector<dex::u1> out(image.data(), image.data() + image.size());
+  header = reinterpret_cast<dex::Header *>(out.data());
+  Sha1 sha1;
+  auto signed_off = offsetof(dex::Header, file_size);
+  sha1.Update(out.data() + signed_off, out.size() - signed_off);
+  sha1.Final(header->signature);
+  header->checksum = dex::ComputeChecksum(header);
+  return out;
+}
+
+} // namespace
+
+std::vector<std::vector<dex::u1>>
+GenerateSyntheticDexes(const SyntheticDexOptions &options) {
+  std::vector<std::vector<dex::u1>> out;
+  for (size_t dex_idx = 0; dex_idx < options.dex_count; ++dex_idx) {
+    out.emplace_back(DexBuilder(options, dex_idx).Build());
+  }
+  return out;
+}
+
+std::string SyntheticClassName(size_t class_idx) {
+  return "Lcom/synth/p" + std::to_string(class_idx % 37) + "/C" +
+         std::to_string(class_idx) + ";";
+}
+
+std::string SyntheticLiteral(size_t literal_idx,
+                             const SyntheticDexOptions &options) {
+  std::string out = kWords[literal_idx % kWordCount];
+  out += '_';
+  out += kWords[(literal_idx / kWordCount) % kWordCount];
+  if (literal_idx % 100 < options.unicode_percent) {
+    // U+00E9 and U+4E2D, two- and three-byte MUTF-8 sequences
+    out += (literal_idx & 1) ? "\xc3\xa9" : "\xe4\xb8\xad";
+  }
+  out += '_';
+  out += std::to_string(literal_idx);
+  return out;
+}
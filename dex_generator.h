@@ -0,0 +1,40 @@
+#pragma once
+
+#include "slicer/dex_format.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Deterministic generator of synthetic but structurally valid dex images,
+// used to benchmark DexHelper without shipping real apps.
+struct SyntheticDexOptions {
+  uint64_t seed = 1;
+  // number of dex files the classes are split into (multi-dex)
+  size_t dex_count = 1;
+  // total over all dexes
+  size_t class_count = 1000;
+  size_t methods_per_class = 8;
+  size_t fields_per_class = 4;
+  // distinct const-string literals per dex
+  size_t string_count = 5000;
+  // average number of invoke instructions per method body
+  size_t invoke_density = 4;
+  // average number of const-string instructions per method body
+  size_t string_density = 2;
+  // average number of field accesses per method body
+  size_t field_density = 2;
+  // fraction (in percent) of invokes targeting classes of other dexes
+  size_t cross_dex_percent = 10;
+  // fraction (in percent) of literals containing non-ASCII characters
+  size_t unicode_percent = 0;
+};
+
+std::vector<std::vector<dex::u1>>
+GenerateSyntheticDexes(const SyntheticDexOptions &options);
+
+// Names of the generated items, for building queries against the output.
+// Class i declares fields f0.. and methods m0.., even ones static.
+std::string SyntheticClassName(size_t class_idx);
+// The literal with index [0, string_count) used by const-string.
+std::string SyntheticLiteral(size_t literal_idx,
+                             const SyntheticDexOptions &options);
@@ -3,23 +3,270 @@
 #include "slicer/reader.h"
 
 #include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <sys/mman.h>
+#include <string_view>
+#include <sys/resource.h>
+#include <tuple>
+#include <type_traits>
+#include <unistd.h>
 
 #include "dex_helper.h"
+#include "dex_opcodes.h"
+#include "trace.h"
 
-DexHelper::DexHelper(
-    const std::vector<std::tuple<const void *, size_t>> &dexs) {
+namespace {
+// adds the page faults of the calling thread during its lifetime to phase
+class FaultScope {
+public:
+  explicit FaultScope(DexHelper::PrefetchStats::Phase &phase) : phase_(phase) {
+    getrusage(RUSAGE_THREAD, &start_);
+  }
+  ~FaultScope() {
+    struct rusage end {};
+    getrusage(RUSAGE_THREAD, &end);
+    phase_.major_faults += end.ru_majflt - start_.ru_majflt;
+    phase_.minor_faults += end.ru_minflt - start_.ru_minflt;
+  }
+
+  FaultScope(const FaultScope &) = delete;
+  FaultScope &operator=(const FaultScope &) = delete;
+
+private:
+  DexHelper::PrefetchStats::Phase &phase_;
+  struct rusage start_ {};
+};
+
+// Inserts id into the sorted posting list unless already there, returns
+// whether it was added. A method is scanned in one go, so its repeats
+// always hit back().
+bool AddPosting(std::vector<uint32_t> &list, uint32_t id) {
+  if (list.empty() || list.back() < id) {
+    list.emplace_back(id);
+    return true;
+  }
+  auto pos = std::lower_bound(list.begin(), list.end(), id);
+  if (*pos == id)
+    return false;
+  list.insert(pos, id);
+  return true;
+}
+
+// whether an index has an id in some dex
+bool Resolved(const std::vector<uint32_t> &ids) {
+  return std::any_of(ids.begin(), ids.end(),
+                     [](uint32_t id) { return id != dex::kNoIndex; });
+}
+
+template <class T>
+void Account(DexHelper::TableUsage &usage, const std::vector<T> &v) {
+  usage.used += v.size() * sizeof(T);
+  usage.capacity += v.capacity() * sizeof(T);
+}
+
+void Account(DexHelper::TableUsage &usage, const std::vector<bool> &v) {
+  usage.used += (v.size() + 7) / 8;
+  usage.capacity += (v.capacity() + 7) / 8;
+}
+
+template <class T>
+void Account(DexHelper::TableUsage &usage,
+             const std::vector<std::vector<T>> &v) {
+  usage.used += v.size() * sizeof(std::vector<T>);
+  usage.capacity += v.capacity() * sizeof(std::vector<T>);
+  for (auto &inner : v)
+    Account(usage, inner);
+}
+
+// node based, so an estimate: one heap node per element plus the buckets
+template <class K, class V>
+void Account(DexHelper::TableUsage &usage,
+             const std::unordered_map<K, V> &map) {
+  constexpr size_t node = (sizeof(void *) + sizeof(std::pair<const K, V>) +
+                           15) / 16 * 16;
+  usage.used += map.size() * node;
+  usage.capacity += map.size() * node + map.bucket_count() * sizeof(void *);
+  if constexpr (std::is_same_v<V, std::vector<uint32_t>>) {
+    for (auto &[_, inner] : map)
+      Account(usage, inner);
+  }
+}
+
+template <class T>
+void Account(DexHelper::TableUsage &usage,
+             const std::vector<std::unordered_map<uint32_t, T>> &v) {
+  usage.used += v.size() * sizeof(v[0]);
+  usage.capacity += v.capacity() * sizeof(v[0]);
+  for (auto &map : v)
+    Account(usage, map);
+}
+
+void Account(DexHelper::TableUsage &usage, const FrozenPostings &lists) {
+  usage.used += lists.bytes();
+  usage.capacity += lists.bytes();
+}
+
+void Account(DexHelper::TableUsage &usage, const StringIndex &index) {
+  usage.used += index.bytes();
+  usage.capacity += index.bytes();
+}
+
+void SetFilter(query_log::Record &record, size_t return_type,
+               short parameter_count, std::string_view parameter_shorty,
+               size_t declaring_class,
+               const std::vector<size_t> &parameter_types,
+               const std::vector<size_t> &contains_parameter_types,
+               const std::vector<size_t> &dex_priority, bool find_first) {
+  record.return_type = return_type;
+  record.parameter_count = parameter_count;
+  record.parameter_shorty = parameter_shorty;
+  record.declaring_class = declaring_class;
+  record.parameter_types = parameter_types;
+  record.contains_parameter_types = contains_parameter_types;
+  record.dex_priority = dex_priority;
+  record.find_first = find_first;
+}
+
+size_t Bucket(size_t size) { return size ? 64 - __builtin_clzll(size) : 0; }
+
+void Histogram(DexHelper::PostingHistogram &histogram,
+               const std::vector<std::vector<uint32_t>> &lists) {
+  for (auto &list : lists) {
+    histogram.buckets[Bucket(list.size())]++;
+  }
+}
+
+void Histogram(DexHelper::PostingHistogram &histogram,
+               const FrozenPostings &lists) {
+  for (size_t i = 0; i < lists.size(); ++i) {
+    histogram.buckets[Bucket(lists[i].size())]++;
+  }
+}
+
+// empties value, unlike clear() or = {} also releasing its memory
+template <class T> void Release(T &value) { value = T(); }
+
+using dex_opcodes::kOpcodes;
+using dex_opcodes::NextInstruction;
+using dex_opcodes::Operand;
+
+// the caches of one dex a scan appends to, in DexHelper::Relation bit order
+using ScanLists = std::array<std::vector<std::vector<uint32_t>> *, 5>;
+
+struct ScanResult {
+  size_t instructions = 0;
+  // posting list entries appended
+  size_t entries = 0;
+  // a string in the matched range is loaded
+  bool match = false;
+};
+
+// The loop of ScanMethod, instantiated per query kind. kRelations is the
+// set of relations it records, 0 to take record at run time; with a single
+// relation only that relation's opcodes get past the table lookup. kMatch
+// compares the loaded strings with [lower, upper).
+template <unsigned kRelations, bool kMatch>
+ScanResult ScanCode(const dex::Code &code, uint32_t method_id, unsigned record,
+                    const ScanLists &lists, size_t lower, size_t upper) {
+  const unsigned mask = kRelations ? kRelations : record;
+  ScanResult out;
+  const dex::u2 *inst = code.insns;
+  const dex::u2 *end = code.insns + code.insns_size;
+  while (inst < end) {
+    ++out.instructions;
+    auto &info = kOpcodes[*inst & 0xff];
+    // most instructions refer to nothing recorded: a single test for them
+    if (auto relations = info.relations & mask) {
+      uint32_t index = Operand(inst, info);
+      if (relations & DexHelper::kStringRelation) {
+        if (kMatch && lower <= index && upper > index)
+          out.match = true;
+        out.entries += AddPosting((*lists[0])[index], method_id);
+      }
+      if (relations & DexHelper::kGettingRelation)
+        out.entries += AddPosting((*lists[3])[index], method_id);
+      if (relations & DexHelper::kSettingRelation)
+        out.entries += AddPosting((*lists[4])[index], method_id);
+      if (relations & DexHelper::kInvokingRelation)
+        out.entries += AddPosting((*lists[1])[method_id], index);
+      if (relations & DexHelper::kInvokedRelation)
+        out.entries += AddPosting((*lists[2])[index], method_id);
+    }
+    inst = NextInstruction(inst, info);
+  }
+  return out;
+}
+
+// Whether code refers to an index in [lower, upper) under kRelation,
+// returning at the first such instruction and recording nothing.
+template <unsigned kRelation>
+bool Refers(const dex::Code &code, uint32_t lower, uint32_t upper,
+            size_t &instructions) {
+  const dex::u2 *inst = code.insns;
+  const dex::u2 *end = code.insns + code.insns_size;
+  while (inst < end) {
+    ++instructions;
+    auto &info = kOpcodes[*inst & 0xff];
+    if (info.relations & kRelation) {
+      uint32_t index = Operand(inst, info);
+      if (lower <= index && index < upper)
+        return true;
+    }
+    inst = NextInstruction(inst, info);
+  }
+  return false;
+}
+} // namespace
+
+DexHelper::DexHelper(const std::vector<std::tuple<const void *, size_t>> &dexs,
+                     const Options &options)
+    : options_(options),
+      log_session_(options.query_log ? options.query_log->NewSession() : 0) {
+  DEX_TRACE("DexHelper::DexHelper");
+  LogScope log(*this, query_log::kOpen);
   for (const auto &[image, size] : dexs) {
     readers_.emplace_back(static_cast<const dex::u1 *>(image), size);
   }
-  size_t dex_count = readers_.size();
+  if (log.record) {
+    for (auto &dex : readers_)
+      log.record->checksums.emplace_back(dex.Header()->checksum);
+    log.record->prefetch = options_.prefetch;
+    log.record->memory_budget = options_.memory_budget;
+    log.record->relations = options_.relations;
+  }
+  perf_stats_.available = options_.perf_counters && perf::Available();
+  if (options_.shared_index != -1)
+    shared_index_ = index_file::MapShared(options_.shared_index);
+  ResizeTables();
+
+  if (!options_.lazy_init) {
+    std::vector<size_t> dex_idxs(readers_.size());
+    std::iota(dex_idxs.begin(), dex_idxs.end(), 0);
+    PrepareDexes(dex_idxs);
+  }
+}
 
-  // init
+void DexHelper::ResizeTables() {
+  size_t dex_count = readers_.size();
+  regions_.resize(dex_count);
+  code_prefetched_.resize(dex_count);
+  dex_cache_bytes_.resize(dex_count);
+  dex_table_bytes_.resize(dex_count);
+  frozen_.resize(dex_count);
+  dex_scanned_.resize(dex_count);
+  index_files_.resize(dex_count);
+  last_used_.resize(dex_count);
+  ever_scanned_.resize(dex_count);
   rev_method_indices_.resize(dex_count);
   rev_class_indices_.resize(dex_count);
   rev_field_indices_.resize(dex_count);
   strings_.resize(dex_count);
+  string_index_.resize(dex_count);
+  string_searches_.resize(dex_count);
   method_codes_.resize(dex_count);
   method_params_.resize(dex_count);
+  method_order_.resize(dex_count);
   string_cache_.resize(dex_count);
   type_cache_.resize(dex_count);
   field_cache_.resize(dex_count);
@@ -31,14 +278,18 @@ DexHelper::DexHelper(
   setting_cache_.resize(dex_count);
   declaring_cache_.resize(dex_count);
   searched_methods_.resize(dex_count);
+  prepared_.resize(dex_count);
+  removed_.resize(dex_count);
+}
 
-  for (size_t dex_idx = 0; dex_idx < dex_count; ++dex_idx) {
+void DexHelper::PrepareDexes(const std::vector<size_t> &dex_idxs) const {
+  DEX_TRACE("PrepareDexes");
+  for (auto dex_idx : dex_idxs) {
     auto &dex = readers_[dex_idx];
     rev_method_indices_[dex_idx].resize(dex.MethodIds().size(), size_t(-1));
     rev_class_indices_[dex_idx].resize(dex.TypeIds().size(), size_t(-1));
     rev_field_indices_[dex_idx].resize(dex.FieldIds().size(), size_t(-1));
 
-    strings_[dex_idx].reserve(dex.StringIds().size());
     method_codes_[dex_idx].resize(dex.MethodIds().size(), nullptr);
     method_params_[dex_idx].resize(dex.MethodIds().size(), nullptr);
 
@@ -47,28 +298,43 @@ DexHelper::DexHelper(
     method_cache_[dex_idx].resize(dex.TypeIds().size());
     class_cache_[dex_idx].resize(dex.TypeIds().size(), dex::kNoIndex);
 
-    string_cache_[dex_idx].resize(dex.StringIds().size());
-    invoking_cache_[dex_idx].resize(dex.MethodIds().size());
-    invoked_cache_[dex_idx].resize(dex.MethodIds().size());
-    getting_cache_[dex_idx].resize(dex.FieldIds().size());
-    setting_cache_[dex_idx].resize(dex.FieldIds().size());
     declaring_cache_[dex_idx].resize(dex.TypeIds().size());
 
     searched_methods_[dex_idx].resize(dex.MethodIds().size());
-  }
+    ever_scanned_[dex_idx].resize(dex.MethodIds().size());
 
-  for (size_t dex_idx = 0; dex_idx < dex_count; ++dex_idx) {
-    auto &dex = readers_[dex_idx];
-    auto &strs = strings_[dex_idx];
-    for (const auto &str : dex.StringIds()) {
-      const dex::u1 *ptr =
-          reinterpret_cast<const dex::u1 *>(dex.Image() + str.string_data_off);
-      size_t len = dex::ReadULeb128(&ptr);
-      strs.emplace_back(reinterpret_cast<const char *>(ptr), len);
+    // map items are sorted by offset, each section ends where the next begins
+    auto *map = dex.DexMapList();
+    for (dex::u4 i = 0; i < map->size; ++i) {
+      Region region;
+      switch (map->list[i].type) {
+      case dex::kStringDataItem:
+        region = kStringData;
+        break;
+      case dex::kClassDataItem:
+        region = kClassData;
+        break;
+      case dex::kCodeItem:
+        region = kCodeItems;
+        break;
+      default:
+        continue;
+      }
+      auto offset = map->list[i].offset;
+      auto end = i + 1 < map->size ? map->list[i + 1].offset
+                                   : dex.Header()->file_size;
+      if (end > offset)
+        regions_[dex_idx][region] = {offset, end - offset};
     }
   }
 
-  for (size_t dex_idx = 0; dex_idx < dex_count; ++dex_idx) {
+  for (auto dex_idx : dex_idxs) {
+    Advise(dex_idx, kClassData, MADV_WILLNEED, prefetch_stats_.class_data);
+  }
+  for (auto dex_idx : dex_idxs) {
+    FaultScope class_data_faults(prefetch_stats_.class_data);
+    DEX_TRACE_ARG("class_data", dex_idx);
+    perf::Scope perf(perf_stats_.class_data, options_.perf_counters);
     auto &dex = readers_[dex_idx];
     for (size_t class_idx = 0; class_idx < dex.ClassDefs().size();
          ++class_idx) {
@@ -100,7 +366,8 @@ DexHelper::DexHelper(
       for (dex::u4 i = 0, method_idx = 0; i < direct_methods_count; ++i) {
         method_idx += dex::ReadULeb128(&class_data);
 
-        auto access_flags = dex::ReadULeb128(&class_data);
+        // access_flags
+        dex::ReadULeb128(&class_data);
         auto offset = dex::ReadULeb128(&class_data);
         if (offset != 0) {
           codes[method_idx] =
@@ -118,7 +385,8 @@ DexHelper::DexHelper(
       for (dex::u4 i = 0, method_idx = 0; i < virtual_methods_count; ++i) {
         method_idx += dex::ReadULeb128(&class_data);
 
-        auto access_flags = dex::ReadULeb128(&class_data);
+        // access_flags
+        dex::ReadULeb128(&class_data);
         auto offset = dex::ReadULeb128(&class_data);
         if (offset != 0) {
           codes[method_idx] =
@@ -134,7 +402,25 @@ DexHelper::DexHelper(
       }
     }
   }
-  for (size_t dex_idx = 0; dex_idx < dex_count; ++dex_idx) {
+  for (auto dex_idx : dex_idxs) {
+    DEX_TRACE_ARG("method_order", dex_idx);
+    perf::Scope perf(perf_stats_.method_order, options_.perf_counters);
+    // code items are laid out in class definition order, so scanning in
+    // code offset order streams through the image instead of jumping
+    auto &codes = method_codes_[dex_idx];
+    auto &order = method_order_[dex_idx];
+    for (uint32_t method_id = 0; method_id < codes.size(); ++method_id) {
+      if (codes[method_id])
+        order.emplace_back(method_id);
+    }
+    // methods sharing a code item in id order, as FirstInCodeOrder ranks
+    std::sort(order.begin(), order.end(), [&codes](uint32_t a, uint32_t b) {
+      return std::tie(codes[a], a) < std::tie(codes[b], b);
+    });
+  }
+  for (auto dex_idx : dex_idxs) {
+    DEX_TRACE_ARG("id_caches", dex_idx);
+    perf::Scope perf(perf_stats_.id_caches, options_.perf_counters);
     auto &dex = readers_[dex_idx];
     auto &type = type_cache_[dex_idx];
     auto &field = field_cache_[dex_idx];
@@ -154,147 +440,783 @@ DexHelper::DexHelper(
       method[m.class_idx][m.name_idx].emplace_back(method_idx);
     }
   }
+  for (auto dex_idx : dex_idxs) {
+    LoadIndex(dex_idx);
+    prepared_[dex_idx] = true;
+    BindIndices(dex_idx);
+    MeasureTables(dex_idx);
+  }
+}
+
+size_t DexHelper::AddDex(const void *image, size_t size) {
+  DEX_TRACE("AddDex");
+  LogScope log(*this, query_log::kAddDex);
+  auto dex_idx = readers_.size();
+  readers_.emplace_back(static_cast<const dex::u1 *>(image), size);
+  if (log.record)
+    log.record->checksums = {readers_.back().Header()->checksum};
+  ResizeTables();
+  for (auto *indices : {&class_indices_, &method_indices_, &field_indices_}) {
+    for (auto &ids : *indices)
+      ids.emplace_back(dex::kNoIndex);
+  }
+  if (!options_.lazy_init)
+    PrepareDexes({dex_idx});
+  return log.Return(dex_idx);
+}
+
+void DexHelper::BindIndices(size_t dex_idx) const {
+  for (size_t class_idx = 0; class_idx < class_indices_.size(); ++class_idx) {
+    auto class_id = FindClassId(dex_idx, DecodeClass(class_idx).name);
+    if (class_id == dex::kNoIndex)
+      continue;
+    class_indices_[class_idx][dex_idx] = class_id;
+    rev_class_indices_[dex_idx][class_id] = class_idx;
+  }
+  for (size_t method_idx = 0; method_idx < method_indices_.size();
+       ++method_idx) {
+    auto method_id = FindMethodId(dex_idx, DecodeMethod(method_idx));
+    if (method_id == dex::kNoIndex)
+      continue;
+    method_indices_[method_idx][dex_idx] = method_id;
+    rev_method_indices_[dex_idx][method_id] = method_idx;
+  }
+  for (size_t field_idx = 0; field_idx < field_indices_.size(); ++field_idx) {
+    auto field_id = FindFieldId(dex_idx, DecodeField(field_idx));
+    if (field_id == dex::kNoIndex)
+      continue;
+    field_indices_[field_idx][dex_idx] = field_id;
+    rev_field_indices_[dex_idx][field_id] = field_idx;
+  }
+}
+
+void DexHelper::RemoveDex(size_t dex_idx) {
+  DEX_TRACE("RemoveDex");
+  LogScope log(*this, query_log::kRemoveDex);
+  if (log.record)
+    log.record->on_dex = dex_idx;
+  if (dex_idx >= readers_.size() || removed_[dex_idx])
+    return;
+  removed_[dex_idx] = true;
+  // nothing left to build, Touch must not read the image any more
+  prepared_[dex_idx] = true;
+  for (auto &ids : method_indices_)
+    ids[dex_idx] = dex::kNoIndex;
+  for (auto &ids : class_indices_)
+    ids[dex_idx] = dex::kNoIndex;
+  for (auto &ids : field_indices_)
+    ids[dex_idx] = dex::kNoIndex;
+  cache_bytes_ -= dex_cache_bytes_[dex_idx];
+  dex_cache_bytes_[dex_idx] = 0;
+
+  Release(regions_[dex_idx]);
+  Release(frozen_[dex_idx]);
+  Release(index_files_[dex_idx]);
+  Release(ever_scanned_[dex_idx]);
+  Release(rev_method_indices_[dex_idx]);
+  Release(rev_class_indices_[dex_idx]);
+  Release(rev_field_indices_[dex_idx]);
+  Release(strings_[dex_idx]);
+  Release(string_index_[dex_idx]);
+  Release(method_codes_[dex_idx]);
+  Release(method_params_[dex_idx]);
+  Release(method_order_[dex_idx]);
+  Release(string_cache_[dex_idx]);
+  Release(type_cache_[dex_idx]);
+  Release(field_cache_[dex_idx]);
+  Release(method_cache_[dex_idx]);
+  Release(class_cache_[dex_idx]);
+  Release(invoking_cache_[dex_idx]);
+  Release(invoked_cache_[dex_idx]);
+  Release(getting_cache_[dex_idx]);
+  Release(setting_cache_[dex_idx]);
+  Release(declaring_cache_[dex_idx]);
+  Release(searched_methods_[dex_idx]);
+  MeasureTables(dex_idx);
+}
+
+std::string_view DexHelper::String(size_t dex_idx, uint32_t string_id) const {
+  if (!strings_[dex_idx].empty())
+    return strings_[dex_idx][string_id];
+  auto &dex = readers_[dex_idx];
+  const dex::u1 *ptr = reinterpret_cast<const dex::u1 *>(
+      dex.Image() + dex.StringIds()[string_id].string_data_off);
+  size_t len = dex::ReadULeb128(&ptr);
+  return {reinterpret_cast<const char *>(ptr), len};
+}
+
+std::string_view DexHelper::TypeName(size_t dex_idx, uint32_t type_id) const {
+  return String(dex_idx, readers_[dex_idx].TypeIds()[type_id].descriptor_idx);
+}
+
+const StringIndex *DexHelper::SearchIndex(size_t dex_idx) const {
+  auto &strs = strings_[dex_idx];
+  if (!strs.empty())
+    return &string_index_[dex_idx];
+  if (++string_searches_[dex_idx] < kStringIndexSearches)
+    return nullptr;
+  auto &dex = readers_[dex_idx];
+  if (dex.StringIds().empty())
+    return nullptr;
+  Advise(dex_idx, kStringData, MADV_WILLNEED, prefetch_stats_.strings);
+  FaultScope string_faults(prefetch_stats_.strings);
+  DEX_TRACE_ARG("strings", dex_idx);
+  perf::Scope perf(perf_stats_.strings, options_.perf_counters);
+  strs.reserve(dex.StringIds().size());
+  for (const auto &str : dex.StringIds()) {
+    const dex::u1 *ptr =
+        reinterpret_cast<const dex::u1 *>(dex.Image() + str.string_data_off);
+    size_t len = dex::ReadULeb128(&ptr);
+    strs.emplace_back(reinterpret_cast<const char *>(ptr), len);
+  }
+  string_index_[dex_idx] = StringIndex(strs);
+  MeasureTables(dex_idx);
+  return &string_index_[dex_idx];
+}
+
+template <class Before>
+uint32_t DexHelper::StringPartition(size_t dex_idx, Before before) const {
+  uint32_t lower = 0, count = readers_[dex_idx].StringIds().size();
+  while (count > 0) {
+    auto half = count / 2;
+    if (before(String(dex_idx, lower + half))) {
+      lower += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  return lower;
 }
 
 std::tuple<uint32_t, uint32_t>
 DexHelper::FindPrefixStringId(size_t dex_idx, std::string_view to_find) const {
-  auto &strs = strings_[dex_idx];
-  if (auto str_lower_bound =
-          std::lower_bound(strs.cbegin(), strs.cend(), to_find),
-      str_upper_bound = std::upper_bound(strs.cbegin(), strs.cend(),
-                                         std::string(to_find) + '\xff');
-      str_upper_bound != strs.cend() && str_lower_bound != strs.cend() &&
-      str_lower_bound <= str_upper_bound) {
-    return {str_lower_bound - strs.cbegin(), str_upper_bound - strs.cbegin()};
+  uint32_t str_lower_bound, str_upper_bound;
+  if (auto *index = SearchIndex(dex_idx)) {
+    auto &strs = strings_[dex_idx];
+    str_lower_bound = index->LowerBound(strs, to_find);
+    str_upper_bound = index->PrefixEnd(strs, to_find);
   } else {
-    return {dex::kNoIndex, dex::kNoIndex};
+    str_lower_bound = StringPartition(dex_idx, [to_find](auto str) {
+      return StringIndex::Compare(str, to_find) < 0;
+    });
+    str_upper_bound = StringPartition(dex_idx, [to_find](auto str) {
+      return str.substr(0, to_find.size()) == to_find ||
+             StringIndex::Compare(str, to_find) < 0;
+    });
   }
+  if (str_lower_bound == str_upper_bound)
+    return {dex::kNoIndex, dex::kNoIndex};
+  return {str_lower_bound, str_upper_bound};
 }
 
 uint32_t DexHelper::FindPrefixStringIdExact(size_t dex_idx,
                                             std::string_view to_find) const {
-  auto &strs = strings_[dex_idx];
-  auto first = std::lower_bound(strs.cbegin(), strs.cend(), to_find);
-  if (first != strs.cend() && *first == to_find)
-    return first - strs.cbegin();
+  if (auto *index = SearchIndex(dex_idx))
+    return index->Find(strings_[dex_idx], to_find);
+  auto pos = StringPartition(dex_idx, [to_find](auto str) {
+    return StringIndex::Compare(str, to_find) < 0;
+  });
+  if (pos < readers_[dex_idx].StringIds().size() &&
+      String(dex_idx, pos) == to_find)
+    return pos;
   return dex::kNoIndex;
 }
 
-void DexHelper::CreateFullCache() const {
+void DexHelper::CreateFullCache(unsigned relations) const {
+  DEX_TRACE("CreateFullCache");
+  BudgetGuard budget{*this};
+  LogScope log(*this, query_log::kCreateFullCache);
+  if (log.record)
+    log.record->relations = relations;
   for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
-    auto &codes = method_codes_[dex_idx];
-    for (size_t method_id = 0; method_id < codes.size(); ++method_id) {
-      ScanMethod(dex_idx, method_id);
+    if (removed_[dex_idx])
+      continue;
+    Touch(dex_idx);
+    PrefetchCode(dex_idx);
+    // let the readahead of the next dex overlap with this scan
+    if (dex_idx + 1 < readers_.size() && !removed_[dex_idx + 1]) {
+      Prepare(dex_idx + 1);
+      PrefetchCode(dex_idx + 1);
     }
+    ScanDex(dex_idx, relations);
   }
 }
 
-bool DexHelper::ScanMethod(size_t dex_idx, uint32_t method_id, size_t str_lower,
+void DexHelper::ScanDex(size_t dex_idx, unsigned relations) const {
+  relations = (relations | options_.relations) & kAllRelations;
+  if ((dex_scanned_[dex_idx] & relations) == relations)
+    return;
+  // after an eviction the file written by the first scan is still there
+  if (LoadIndex(dex_idx))
+    return;
+  PrefetchCode(dex_idx);
+  FaultScope faults(prefetch_stats_.code);
+  DEX_TRACE_ARG("scan_dex", dex_idx);
+  // sized even if no method has code, the frozen tables must match the dex
+  AllocateCaches(dex_idx, relations);
+  Advise(dex_idx, kCodeItems, MADV_SEQUENTIAL, prefetch_stats_.code);
+  for (auto method_id : method_order_[dex_idx]) {
+    ScanMethod(dex_idx, method_id, relations);
+  }
+  Advise(dex_idx, kCodeItems, MADV_NORMAL, prefetch_stats_.code);
+  dex_scanned_[dex_idx] |= relations;
+  if (options_.compress_postings)
+    FreezeCaches(dex_idx);
+  // an index file holds every relation
+  if (options_.index_dir && dex_scanned_[dex_idx] == kAllRelations)
+    SaveIndex(dex_idx);
+}
+
+bool DexHelper::LoadIndex(size_t dex_idx) const {
+  if (!options_.index_dir && shared_index_.empty())
+    return false;
+  DEX_TRACE_ARG("load_index", dex_idx);
+  auto &dex = readers_[dex_idx];
+  auto &header = *dex.Header();
+  uint32_t strings = dex.StringIds().size();
+  uint32_t methods = dex.MethodIds().size();
+  uint32_t fields = dex.FieldIds().size();
+  // in PostingTable order, every entry is a method id
+  std::vector<index_file::Table> shapes = {
+      {strings, methods}, {methods, methods}, {methods, methods},
+      {fields, methods},  {fields, methods}};
+  std::vector<FrozenPostings> tables;
+  bool found = shared_index_.Find(header, shapes, tables);
+  if (!found && options_.index_dir) {
+    auto &file = index_files_[dex_idx];
+    if (file.empty())
+      file = index_file::Open(index_file::Path(options_.index_dir, header));
+    found = file.Find(header, shapes, tables);
+    if (!found)
+      Release(file);
+  }
+  if (!found)
+    return false;
+  // views of the mappings, the heap only holds the caches of other dexes
+  for (int table = 0; table < kPostingTableCount; ++table) {
+    frozen_[dex_idx][table] = std::move(tables[table]);
+    Release(Lists(PostingTable(table))[dex_idx]);
+  }
+  searched_methods_[dex_idx].assign(methods, kAllRelations);
+  dex_scanned_[dex_idx] = kAllRelations;
+  cache_bytes_ -= dex_cache_bytes_[dex_idx];
+  dex_cache_bytes_[dex_idx] = 0;
+  return true;
+}
+
+void DexHelper::SaveIndex(size_t dex_idx) const {
+  DEX_TRACE_ARG("save_index", dex_idx);
+  std::vector<uint8_t> section;
+  EncodeIndex(dex_idx, section);
+  index_file::Write(
+      index_file::Path(options_.index_dir, *readers_[dex_idx].Header()),
+      section);
+}
+
+void DexHelper::EncodeIndex(size_t dex_idx, std::vector<uint8_t> &out) const {
+  auto &frozen = frozen_[dex_idx];
+  // without compress_postings the caches stay vectors, write a packed copy
+  std::array<FrozenPostings, kPostingTableCount> packed;
+  std::vector<const FrozenPostings *> tables;
+  for (int table = 0; table < kPostingTableCount; ++table) {
+    if (frozen[table].empty())
+      packed[table] = FrozenPostings(Lists(PostingTable(table))[dex_idx]);
+    tables.emplace_back(frozen[table].empty() ? &packed[table]
+                                              : &frozen[table]);
+  }
+  index_file::Encode(out, *readers_[dex_idx].Header(), tables);
+}
+
+int DexHelper::ExportIndex() const {
+  DEX_TRACE("ExportIndex");
+  BudgetGuard budget{*this};
+  std::vector<uint8_t> sections;
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    if (removed_[dex_idx])
+      continue;
+    Touch(dex_idx);
+    // nothing is evicted before the guard runs, so each dex stays scanned
+    ScanDex(dex_idx, kAllRelations);
+    EncodeIndex(dex_idx, sections);
+  }
+  return index_file::Share(sections);
+}
+
+auto DexHelper::Lists(PostingTable table) const
+    -> std::vector<std::vector<std::vector<uint32_t>>> & {
+  switch (table) {
+  case kStringPostings:
+    return string_cache_;
+  case kInvokingPostings:
+    return invoking_cache_;
+  case kInvokedPostings:
+    return invoked_cache_;
+  case kGettingPostings:
+    return getting_cache_;
+  default:
+    return setting_cache_;
+  }
+}
+
+PostingList DexHelper::Postings(PostingTable table, size_t dex_idx,
+                                uint32_t id) const {
+  auto &frozen = frozen_[dex_idx][table];
+  if (!frozen.empty())
+    return frozen[id];
+  // nothing was scanned for a table not yet sized, which a relation the
+  // profile leaves out may never be: a scan sizing it moves the lists, so
+  // callers take a new view after scanning
+  auto &lists = Lists(table)[dex_idx];
+  if (lists.empty())
+    return PostingList();
+  return PostingList(lists[id]);
+}
+
+void DexHelper::AllocateCaches(size_t dex_idx, unsigned relations) const {
+  auto &dex = readers_[dex_idx];
+  // in PostingTable order
+  const size_t sizes[] = {dex.StringIds().size(), dex.MethodIds().size(),
+                          dex.MethodIds().size(), dex.FieldIds().size(),
+                          dex.FieldIds().size()};
+  for (int table = 0; table < kPostingTableCount; ++table) {
+    if (!(relations & (1u << table)) || !frozen_[dex_idx][table].empty())
+      continue;
+    auto &lists = Lists(PostingTable(table))[dex_idx];
+    if (lists.size() != sizes[table])
+      lists.resize(sizes[table]);
+  }
+}
+
+void DexHelper::FreezeCaches(size_t dex_idx) const {
+  static_assert(kStringRelation == 1 << kStringPostings &&
+                kInvokingRelation == 1 << kInvokingPostings &&
+                kInvokedRelation == 1 << kInvokedPostings &&
+                kGettingRelation == 1 << kGettingPostings &&
+                kSettingRelation == 1 << kSettingPostings);
+  DEX_TRACE_ARG("freeze", dex_idx);
+  auto &frozen = frozen_[dex_idx];
+  size_t bytes = 0;
+  for (int table = 0; table < kPostingTableCount; ++table) {
+    auto &lists = Lists(PostingTable(table))[dex_idx];
+    if (frozen[table].empty() && (dex_scanned_[dex_idx] & (1u << table))) {
+      frozen[table] = FrozenPostings(lists);
+      std::vector<std::vector<uint32_t>>().swap(lists);
+    }
+    if (!frozen[table].empty()) {
+      bytes += frozen[table].bytes();
+      continue;
+    }
+    // still filled method by method
+    for (auto &list : lists)
+      bytes += list.size() * sizeof(uint32_t);
+  }
+  cache_bytes_ = cache_bytes_ - dex_cache_bytes_[dex_idx] + bytes;
+  dex_cache_bytes_[dex_idx] = bytes;
+}
+
+void DexHelper::Advise(size_t dex_idx, Region region, int advice,
+                       PrefetchStats::Phase &phase) const {
+  if (!options_.prefetch)
+    return;
+  auto [offset, size] = regions_[dex_idx][region];
+  if (size == 0)
+    return;
+  static const uintptr_t page_mask = ~uintptr_t(sysconf(_SC_PAGESIZE) - 1);
+  auto begin = reinterpret_cast<uintptr_t>(readers_[dex_idx].Image() + offset);
+  auto aligned = begin & page_mask;
+  if (madvise(reinterpret_cast<void *>(aligned), size + (begin - aligned),
+              advice) == 0) {
+    ++phase.advise_calls;
+    phase.advised_bytes += size;
+  }
+}
+
+void DexHelper::PrefetchCode(size_t dex_idx) const {
+  if (code_prefetched_[dex_idx])
+    return;
+  code_prefetched_[dex_idx] = true;
+  Advise(dex_idx, kCodeItems, MADV_WILLNEED, prefetch_stats_.code);
+}
+
+bool DexHelper::ScanMethod(size_t dex_idx, uint32_t method_id,
+                           unsigned relations, size_t str_lower,
                            size_t str_upper) const {
-  auto &str_cache = string_cache_[dex_idx];
-  auto &inv_cache = invoking_cache_[dex_idx];
-  auto &inved_cache = invoked_cache_[dex_idx];
-  auto &get_cache = getting_cache_[dex_idx];
-  auto &set_cache = setting_cache_[dex_idx];
-  auto &scanned = searched_methods_[dex_idx];
-
-  bool match_str = false;
-  if (scanned[method_id])
-    return match_str;
-  scanned[method_id] = true;
+  auto &scanned = searched_methods_[dex_idx][method_id];
+  if ((scanned & relations) == relations) {
+    if (query_stats_)
+      ++query_stats_->cache_hits;
+    return false;
+  }
+  // the caches of the relations already recorded may be frozen
+  unsigned record = (relations | options_.relations) & ~scanned;
+  if (scanned == 0) {
+    if (ever_scanned_[dex_idx][method_id])
+      ++eviction_stats_.rescans;
+    else
+      ever_scanned_[dex_idx][method_id] = true;
+  }
+  scanned |= record;
+  AllocateCaches(dex_idx, record);
   auto &code = method_codes_[dex_idx][method_id];
   if (!code)
-    return match_str;
-  const dex::u2 *inst = code->insns;
-  const dex::u2 *end = code->insns + code->insns_size;
-  size_t ins_count = 0;
-  while (inst < end) {
-    ins_count++;
-    dex::u1 opcode = *inst & 0xff;
-    if (opcode == 0x1a) {
-      auto str_idx = inst[1];
-      if (str_lower <= str_idx && str_upper > str_idx) {
-        match_str = true;
-      }
-      str_cache[str_idx].emplace_back(method_id);
+    return false;
+  perf::Scope perf(perf_stats_.scan, options_.perf_counters);
+  if (options_.perf_counters)
+    ++perf_stats_.scan_calls;
+  ScanLists lists{&string_cache_[dex_idx], &invoking_cache_[dex_idx],
+                  &invoked_cache_[dex_idx], &getting_cache_[dex_idx],
+                  &setting_cache_[dex_idx]};
+  bool match = str_lower != size_t(-1) && (record & kStringRelation);
+  ScanResult result;
+  // the records of a full scan with the default or a single relation
+  // profile, and the first scan of a method by a query of each kind
+  switch (record) {
+  case kAllRelations:
+    result = match ? ScanCode<kAllRelations, true>(*code, method_id, record,
+                                                   lists, str_lower, str_upper)
+                   : ScanCode<kAllRelations, false>(*code, method_id, record,
+                                                    lists, 0, 0);
+    break;
+  case kStringRelation:
+    result = match ? ScanCode<kStringRelation, true>(
+                         *code, method_id, record, lists, str_lower, str_upper)
+                   : ScanCode<kStringRelation, false>(*code, method_id, record,
+                                                      lists, 0, 0);
+    break;
+  case kInvokingRelation:
+    result = ScanCode<kInvokingRelation, false>(*code, method_id, record,
+                                                lists, 0, 0);
+    break;
+  case kInvokedRelation:
+    result = ScanCode<kInvokedRelation, false>(*code, method_id, record, lists,
+                                               0, 0);
+    break;
+  case kGettingRelation:
+    result = ScanCode<kGettingRelation, false>(*code, method_id, record, lists,
+                                               0, 0);
+    break;
+  case kSettingRelation:
+    result = ScanCode<kSettingRelation, false>(*code, method_id, record, lists,
+                                               0, 0);
+    break;
+  default:
+    result = match ? ScanCode<0, true>(*code, method_id, record, lists,
+                                       str_lower, str_upper)
+                   : ScanCode<0, false>(*code, method_id, record, lists, 0, 0);
+    break;
+  }
+  dex_cache_bytes_[dex_idx] += result.entries * sizeof(uint32_t);
+  cache_bytes_ += result.entries * sizeof(uint32_t);
+  if (query_stats_) {
+    ++query_stats_->methods_scanned;
+    query_stats_->instructions += result.instructions;
+  }
+  return result.match;
+}
+
+uint32_t DexHelper::FirstInCodeOrder(size_t dex_idx, PostingList list,
+                                     uint32_t first) const {
+  auto &codes = method_codes_[dex_idx];
+  for (auto m : list) {
+    if (first == dex::kNoIndex ||
+        std::tie(codes[m], m) < std::tie(codes[first], first))
+      first = m;
+  }
+  return first;
+}
+
+bool DexHelper::Probe(size_t dex_idx, uint32_t method_id, Relation relation,
+                      uint32_t lower, uint32_t upper) const {
+  auto &code = method_codes_[dex_idx][method_id];
+  if (!code)
+    return false;
+  perf::Scope perf(perf_stats_.scan, options_.perf_counters);
+  if (options_.perf_counters)
+    ++perf_stats_.scan_calls;
+  size_t instructions = 0;
+  bool found = false;
+  switch (relation) {
+  case kStringRelation:
+    found = Refers<kStringRelation>(*code, lower, upper, instructions);
+    break;
+  case kInvokingRelation:
+  case kInvokedRelation:
+    found = Refers<kInvokedRelation>(*code, lower, upper, instructions);
+    break;
+  case kGettingRelation:
+    found = Refers<kGettingRelation>(*code, lower, upper, instructions);
+    break;
+  case kSettingRelation:
+    found = Refers<kSettingRelation>(*code, lower, upper, instructions);
+    break;
+  default:
+    break;
+  }
+  if (query_stats_) {
+    ++query_stats_->methods_scanned;
+    query_stats_->instructions += instructions;
+  }
+  return found;
+}
+
+namespace {
+std::mutex global_stats_mutex;
+std::array<DexHelper::QueryStats, DexHelper::kQueryKindCount> global_stats;
+} // namespace
+
+auto DexHelper::QueryStats::operator+=(const QueryStats &other)
+    -> QueryStats & {
+  queries += other.queries;
+  methods_visited += other.methods_visited;
+  methods_rejected += other.methods_rejected;
+  methods_scanned += other.methods_scanned;
+  instructions += other.instructions;
+  cache_hits += other.cache_hits;
+  indices_created += other.indices_created;
+  elapsed_ms += other.elapsed_ms;
+  counters += other.counters;
+  return *this;
+}
+
+auto DexHelper::GlobalQueryStats() -> std::array<QueryStats, kQueryKindCount> {
+  std::lock_guard lock(global_stats_mutex);
+  return global_stats;
+}
+
+void DexHelper::ResetGlobalQueryStats() {
+  std::lock_guard lock(global_stats_mutex);
+  global_stats = {};
+}
+
+DexHelper::QueryScope::QueryScope(const DexHelper &helper, QueryKind kind,
+                                  QueryStats *out)
+    : helper_(helper), kind_(kind), out_(out), outer_(helper.query_stats_) {
+  stats.queries = 1;
+  helper_.query_stats_ = &stats;
+  chronometer_.emplace(stats.elapsed_ms);
+  perf_.emplace(stats.counters, helper_.options_.perf_counters);
+}
+
+DexHelper::QueryScope::~QueryScope() {
+  perf_.reset();
+  chronometer_.reset();
+  helper_.query_stats_ = outer_;
+  if (out_)
+    *out_ = stats;
+  std::lock_guard lock(global_stats_mutex);
+  global_stats[kind_] += stats;
+}
+
+DexHelper::LogScope::LogScope(const DexHelper &helper, query_log::Op op,
+                              const std::vector<size_t> *out)
+    : helper_(helper), out_(out) {
+  if (!helper_.options_.query_log || helper_.logging_)
+    return;
+  helper_.logging_ = true;
+  record.emplace();
+  record->op = op;
+  record->session = helper_.log_session_;
+  chronometer_.emplace(record->elapsed_ms);
+}
+
+DexHelper::LogScope::~LogScope() {
+  if (!record)
+    return;
+  chronometer_.reset();
+  // out is the named return value of the query, still alive here
+  if (out_)
+    record->result = *out_;
+  if (set_)
+    record->result = set_->Flatten();
+  helper_.logging_ = false;
+  helper_.options_.query_log->Append(*record);
+}
+
+size_t DexHelper::LogScope::Return(size_t index) {
+  if (record)
+    record->result = {index};
+  return index;
+}
+
+void DexHelper::SetMemoryBudget(size_t bytes) {
+  LogScope log(*this, query_log::kSetMemoryBudget);
+  if (log.record)
+    log.record->memory_budget = bytes;
+  options_.memory_budget = bytes;
+  EnforceMemoryBudget();
+}
+
+void DexHelper::DropCaches() {
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    if (dex_cache_bytes_[dex_idx] != 0)
+      EvictCaches(dex_idx);
+  }
+}
+
+void DexHelper::Touch(size_t dex_idx) const {
+  Prepare(dex_idx);
+  last_used_[dex_idx] = ++clock_;
+}
+
+void DexHelper::EnforceMemoryBudget() const {
+  if (options_.memory_budget == 0 || cache_bytes_ <= options_.memory_budget)
+    return;
+  std::vector<size_t> lru;
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    if (dex_cache_bytes_[dex_idx] != 0)
+      lru.emplace_back(dex_idx);
+  }
+  std::sort(lru.begin(), lru.end(), [this](size_t a, size_t b) {
+    return last_used_[a] < last_used_[b];
+  });
+  for (auto dex_idx : lru) {
+    if (cache_bytes_ <= options_.memory_budget)
+      break;
+    EvictCaches(dex_idx);
+  }
+}
+
+void DexHelper::EvictCaches(size_t dex_idx) const {
+  auto &dex = readers_[dex_idx];
+  // the next scan recording a relation sizes its cache again
+  for (int table = 0; table < kPostingTableCount; ++table)
+    Release(Lists(PostingTable(table))[dex_idx]);
+  searched_methods_[dex_idx].assign(dex.MethodIds().size(), 0);
+
+  frozen_[dex_idx] = {};
+  dex_scanned_[dex_idx] = 0;
+
+  auto bytes = dex_cache_bytes_[dex_idx];
+  cache_bytes_ -= bytes;
+  dex_cache_bytes_[dex_idx] = 0;
+  ++eviction_stats_.evictions;
+  eviction_stats_.evicted_bytes += bytes;
+}
+
+void DexHelper::AccountTables(size_t dex_idx, std::vector<TableUsage> &tables,
+                              bool postings) const {
+  auto table = [&tables](const char *name) -> TableUsage & {
+    return tables.emplace_back(TableUsage{.name = name});
+  };
+  auto lists = [&](const char *name, PostingTable posting_table) {
+    if (!postings)
+      return;
+    Account(table(name), Lists(posting_table)[dex_idx]);
+    Account(tables.back(), frozen_[dex_idx][posting_table]);
+  };
+  Account(table("rev_method_indices"), rev_method_indices_[dex_idx]);
+  Account(table("rev_class_indices"), rev_class_indices_[dex_idx]);
+  Account(table("rev_field_indices"), rev_field_indices_[dex_idx]);
+  Account(table("strings"), strings_[dex_idx]);
+  Account(table("string_index"), string_index_[dex_idx]);
+  Account(table("method_codes"), method_codes_[dex_idx]);
+  Account(table("method_params"), method_params_[dex_idx]);
+  Account(table("method_order"), method_order_[dex_idx]);
+  Account(table("type_cache"), type_cache_[dex_idx]);
+  Account(table("method_cache"), method_cache_[dex_idx]);
+  Account(table("field_cache"), field_cache_[dex_idx]);
+  Account(table("class_cache"), class_cache_[dex_idx]);
+  lists("string_cache", kStringPostings);
+  lists("invoking_cache", kInvokingPostings);
+  lists("invoked_cache", kInvokedPostings);
+  lists("getting_cache", kGettingPostings);
+  lists("setting_cache", kSettingPostings);
+  Account(table("declaring_cache"), declaring_cache_[dex_idx]);
+  Account(table("searched_methods"), searched_methods_[dex_idx]);
+  Account(table("ever_scanned"), ever_scanned_[dex_idx]);
+}
+
+void DexHelper::MeasureTables(size_t dex_idx) const {
+  std::vector<TableUsage> tables;
+  AccountTables(dex_idx, tables, false);
+  size_t bytes = 0;
+  for (auto &usage : tables)
+    bytes += usage.capacity;
+  table_bytes_ = table_bytes_ - dex_table_bytes_[dex_idx] + bytes;
+  dex_table_bytes_[dex_idx] = bytes;
+}
+
+size_t DexHelper::TableBytes() const {
+  size_t bytes = table_bytes_;
+  // the posting tables are sized and released as relations are scanned,
+  // CacheBytes counts what their lists hold
+  for (int table = 0; table < kPostingTableCount; ++table) {
+    for (auto &lists : Lists(PostingTable(table)))
+      bytes += lists.capacity() * sizeof(lists[0]);
+  }
+  TableUsage indices{.name = "indices"};
+  Account(indices, method_indices_);
+  Account(indices, class_indices_);
+  Account(indices, field_indices_);
+  return bytes + indices.capacity;
+}
+
+auto DexHelper::MemoryStats() const -> MemoryUsage {
+  MemoryUsage out;
+  out.per_dex.resize(readers_.size());
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    auto &tables = out.per_dex[dex_idx];
+    AccountTables(dex_idx, tables, true);
+
+    if (dex_idx == 0) {
+      for (auto &usage : tables)
+        out.tables.push_back({.name = usage.name});
     }
-    if (opcode == 0x1b) {
-      auto str_idx = *reinterpret_cast<const dex::u4 *>(&inst[1]);
-      if (str_lower <= str_idx && str_upper > str_idx) {
-        match_str = true;
-      }
-      str_cache[str_idx].emplace_back(method_id);
-    }
-    if ((opcode >= 0x52 && opcode <= 0x58) ||
-        (opcode >= 0x60 && opcode <= 0x66)) {
-      auto field_idx = inst[1];
-      get_cache[field_idx].emplace_back(method_id);
-    }
-    if ((opcode >= 0x59 && opcode <= 0x5f) ||
-        (opcode >= 0x67 && opcode <= 0x6d)) {
-      auto field_idx = inst[1];
-      set_cache[field_idx].emplace_back(method_id);
-    }
-    if ((opcode >= 0x74 && opcode <= 0x78) ||
-        (opcode >= 0x6e && opcode <= 0x72)) {
-      auto callee = inst[1];
-      inv_cache[method_id].emplace_back(callee);
-      inved_cache[callee].emplace_back(method_id);
-    }
-    if (opcode == 0x00) {
-      if (*inst == 0x0100) {
-        // packed-switch-payload
-        inst += inst[1] * 2 + 3;
-      } else if (*inst == 0x0200) {
-        // sparse-switch-payload
-        inst += inst[1] * 4 + 1;
-      } else if (*inst == 0x0300) {
-        // fill-array-data-payload
-        inst +=
-            (*reinterpret_cast<const dex::u4 *>(&inst[2]) * inst[1] + 1) / 2 +
-            3;
-      }
+    for (size_t i = 0; i < tables.size(); ++i) {
+      out.tables[i].used += tables[i].used;
+      out.tables[i].capacity += tables[i].capacity;
     }
-    inst += opcode_len[opcode];
   }
-  return match_str;
+  Account(out.tables.emplace_back(TableUsage{.name = "method_indices"}),
+          method_indices_);
+  Account(out.tables.emplace_back(TableUsage{.name = "class_indices"}),
+          class_indices_);
+  Account(out.tables.emplace_back(TableUsage{.name = "field_indices"}),
+          field_indices_);
+  for (auto &usage : out.tables) {
+    out.used += usage.used;
+    out.capacity += usage.capacity;
+  }
+
+  for (auto &[name, cache, table] :
+       {std::tuple{"string_cache", &string_cache_, kStringPostings},
+        std::tuple{"invoking_cache", &invoking_cache_, kInvokingPostings},
+        std::tuple{"invoked_cache", &invoked_cache_, kInvokedPostings},
+        std::tuple{"getting_cache", &getting_cache_, kGettingPostings},
+        std::tuple{"setting_cache", &setting_cache_, kSettingPostings},
+        std::tuple{"declaring_cache", &declaring_cache_, kPostingTableCount}}) {
+    auto &histogram = out.postings.emplace_back(PostingHistogram{.name = name});
+    for (size_t dex_idx = 0; dex_idx < cache->size(); ++dex_idx) {
+      Histogram(histogram, (*cache)[dex_idx]);
+      if (table != kPostingTableCount)
+        Histogram(histogram, frozen_[dex_idx][table]);
+    }
+  }
+  return out;
 }
 
-std::tuple<std::vector<std::vector<uint32_t>>,
-           std::vector<std::vector<uint32_t>>>
+std::tuple<std::vector<uint32_t>, std::vector<uint32_t>>
 DexHelper::ConvertParameters(
-    const std::vector<size_t> &parameter_types,
+    size_t dex_idx, const std::vector<size_t> &parameter_types,
     const std::vector<size_t> &contains_parameter_types) const {
-  std::vector<std::vector<uint32_t>> parameter_types_ids(readers_.size());
-  std::vector<std::vector<uint32_t>> contains_parameter_types_ids(
-      readers_.size());
-  if (!parameter_types.empty()) {
-    for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
-      parameter_types_ids[dex_idx].reserve(parameter_types.size());
-    }
-    for (auto &param : parameter_types) {
-      if (param != size_t(-1) && param >= class_indices_.size())
-        return {parameter_types_ids, contains_parameter_types_ids};
-      auto &ids = class_indices_[param];
-      for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
-        parameter_types_ids[dex_idx].emplace_back(ids[dex_idx]);
-      }
-    }
+  std::vector<uint32_t> parameter_types_ids;
+  std::vector<uint32_t> contains_parameter_types_ids;
+  parameter_types_ids.reserve(parameter_types.size());
+  for (auto &param : parameter_types) {
+    if (param != size_t(-1) && param >= class_indices_.size())
+      return {parameter_types_ids, contains_parameter_types_ids};
+    // -1, as a log or a client may send, is a type no dex has
+    parameter_types_ids.emplace_back(
+        param == size_t(-1) ? dex::kNoIndex : class_indices_[param][dex_idx]);
   }
 
-  if (!contains_parameter_types.empty()) {
-    for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
-      contains_parameter_types_ids[dex_idx].reserve(
-          contains_parameter_types.size());
-    }
-    for (auto &param : contains_parameter_types) {
-      if (param != size_t(-1) && param >= class_indices_.size())
-        return {parameter_types_ids, contains_parameter_types_ids};
-      auto &ids = class_indices_[param];
-      for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
-        contains_parameter_types_ids[dex_idx].emplace_back(ids[dex_idx]);
-      }
-    }
+  contains_parameter_types_ids.reserve(contains_parameter_types.size());
+  for (auto &param : contains_parameter_types) {
+    if (param != size_t(-1) && param >= class_indices_.size())
+      return {parameter_types_ids, contains_parameter_types_ids};
+    contains_parameter_types_ids.emplace_back(
+        param == size_t(-1) ? dex::kNoIndex : class_indices_[param][dex_idx]);
   }
   return {parameter_types_ids, contains_parameter_types_ids};
 }
@@ -304,18 +1226,30 @@ std::vector<size_t> DexHelper::FindMethodUsingString(
     short parameter_count, std::string_view parameter_shorty,
     size_t declaring_class, const std::vector<size_t> &parameter_types,
     const std::vector<size_t> &contains_parameter_types,
-    const std::vector<size_t> &dex_priority, bool find_first) const {
-
+    const std::vector<size_t> &dex_priority, bool find_first,
+    QueryStats *stats) const {
+  DEX_TRACE("FindMethodUsingString");
+  QueryScope query(*this, kFindMethodUsingString, stats);
+  BudgetGuard budget{*this};
   std::vector<size_t> out;
+  LogScope log(*this, query_log::kFindMethodUsingString, &out);
+  if (log.record) {
+    log.record->str = str;
+    log.record->match_prefix = match_prefix;
+    SetFilter(*log.record, return_type, parameter_count, parameter_shorty,
+              declaring_class, parameter_types, contains_parameter_types,
+              dex_priority, find_first);
+  }
 
   if (return_type != size_t(-1) && return_type >= class_indices_.size())
     return out;
   if (declaring_class != size_t(-1) && declaring_class >= class_indices_.size())
     return out;
-  const auto [parameter_types_ids, contains_parameter_types_ids] =
-      ConvertParameters(parameter_types, contains_parameter_types);
-
+  bool probe = find_first && !(options_.relations & kStringRelation);
   for (auto dex_idx : GetPriority(dex_priority)) {
+    Touch(dex_idx);
+    const auto [parameter_types_ids, contains_parameter_types_ids] =
+        ConvertParameters(dex_idx, parameter_types, contains_parameter_types);
     uint32_t lower, upper;
     if (match_prefix) {
       std::tie(lower, upper) = FindPrefixStringId(dex_idx, str);
@@ -327,22 +1261,34 @@ std::vector<size_t> DexHelper::FindMethodUsingString(
         continue;
       ++upper;
     }
-    auto &codes = method_codes_[dex_idx];
-    auto &strs = string_cache_[dex_idx];
 
-    if (find_first) {
-      for (auto s = lower; s < upper; ++s) {
-        for (auto &m : strs[s]) {
-          out.emplace_back(CreateMethodIndex(dex_idx, m));
-          return out;
-        }
-      }
+    auto first_cached = [&] {
+      uint32_t first = dex::kNoIndex;
+      for (auto s = lower; s < upper; ++s)
+        first = FirstInCodeOrder(
+            dex_idx, Postings(kStringPostings, dex_idx, s), first);
+      return first;
+    };
+    uint32_t first = find_first ? first_cached() : dex::kNoIndex;
+    if (first != dex::kNoIndex && (dex_scanned_[dex_idx] & kStringRelation)) {
+      ++query.stats.cache_hits;
+      out.emplace_back(CreateMethodIndex(dex_idx, first));
+      return out;
     }
 
-    for (size_t method_id = 0; method_id < codes.size(); ++method_id) {
+    PrefetchCode(dex_idx);
+    FaultScope faults(prefetch_stats_.code);
+    DEX_TRACE_ARG("scan_dex", dex_idx);
+    for (auto method_id : method_order_[dex_idx]) {
+      // the cached first, unless a method before it was not scanned yet
+      if (method_id == first)
+        break;
       auto &scanned = searched_methods_[dex_idx];
-      if (scanned[method_id])
+      ++query.stats.methods_visited;
+      if (scanned[method_id] & kStringRelation) {
+        ++query.stats.cache_hits;
         continue;
+      }
       if (!IsMethodMatch(dex_idx, method_id,
                          return_type == size_t(-1)
                              ? dex::kNoIndex
@@ -351,22 +1297,46 @@ std::vector<size_t> DexHelper::FindMethodUsingString(
                          declaring_class == size_t(-1)
                              ? dex::kNoIndex
                              : class_indices_[declaring_class][dex_idx],
-                         parameter_types_ids[dex_idx],
-                         contains_parameter_types_ids[dex_idx])) {
+                         parameter_types_ids, contains_parameter_types_ids)) {
+        ++query.stats.methods_rejected;
         continue;
       }
-      bool match = ScanMethod(dex_idx, method_id, lower, upper);
+      if (probe) {
+        if (Probe(dex_idx, method_id, kStringRelation, lower, upper)) {
+          out.emplace_back(CreateMethodIndex(dex_idx, method_id));
+          return out;
+        }
+        continue;
+      }
+      bool match = ScanMethod(dex_idx, method_id, kStringRelation, lower,
+                              upper);
       if (match && find_first)
         break;
     }
 
-    for (auto s = lower; s < upper; ++s) {
-      for (auto &m : strs[s]) {
-        out.emplace_back(CreateMethodIndex(dex_idx, m));
-        if (find_first)
-          return out;
+    if (find_first) {
+      if (first = first_cached(); first != dex::kNoIndex) {
+        out.emplace_back(CreateMethodIndex(dex_idx, first));
+        return out;
       }
+      continue;
+    }
+    if (upper - lower == 1) {
+      for (auto m : Postings(kStringPostings, dex_idx, lower))
+        out.emplace_back(CreateMethodIndex(dex_idx, m));
+      continue;
+    }
+    // a method using several strings of the prefix range is on each list
+    std::vector<uint32_t> method_ids;
+    for (auto s = lower; s < upper; ++s) {
+      auto postings = Postings(kStringPostings, dex_idx, s);
+      method_ids.insert(method_ids.end(), postings.begin(), postings.end());
     }
+    std::sort(method_ids.begin(), method_ids.end());
+    method_ids.erase(std::unique(method_ids.begin(), method_ids.end()),
+                     method_ids.end());
+    for (auto m : method_ids)
+      out.emplace_back(CreateMethodIndex(dex_idx, m));
   }
   return out;
 }
@@ -376,9 +1346,19 @@ std::vector<size_t> DexHelper::FindMethodInvoking(
     std::string_view parameter_shorty, size_t declaring_class,
     const std::vector<size_t> &parameter_types,
     const std::vector<size_t> &contains_parameter_types,
-    const std::vector<size_t> &dex_priority, bool find_first) const {
-
+    const std::vector<size_t> &dex_priority, bool find_first,
+    QueryStats *stats) const {
+  DEX_TRACE("FindMethodInvoking");
+  QueryScope query(*this, kFindMethodInvoking, stats);
+  BudgetGuard budget{*this};
   std::vector<size_t> out;
+  LogScope log(*this, query_log::kFindMethodInvoking, &out);
+  if (log.record) {
+    log.record->target = method_idx;
+    SetFilter(*log.record, return_type, parameter_count, parameter_shorty,
+              declaring_class, parameter_types, contains_parameter_types,
+              dex_priority, find_first);
+  }
 
   if (method_idx >= method_indices_.size())
     return out;
@@ -386,18 +1366,16 @@ std::vector<size_t> DexHelper::FindMethodInvoking(
     return out;
   if (declaring_class != size_t(-1) && declaring_class >= class_indices_.size())
     return out;
-  const auto [parameter_types_ids, contains_parameter_types_ids] =
-      ConvertParameters(parameter_types, contains_parameter_types);
-
-  const auto method_ids = method_indices_[method_idx];
 
   for (auto dex_idx : GetPriority(dex_priority)) {
-    auto &codes = method_codes_[dex_idx];
-    auto caller_id = method_ids[dex_idx];
+    Touch(dex_idx);
+    const auto [parameter_types_ids, contains_parameter_types_ids] =
+        ConvertParameters(dex_idx, parameter_types, contains_parameter_types);
+    auto caller_id = method_indices_[method_idx][dex_idx];
     if (caller_id == dex::kNoIndex)
       continue;
-    ScanMethod(dex_idx, caller_id);
-    for (auto callee_id : invoking_cache_[dex_idx][caller_id]) {
+    ScanMethod(dex_idx, caller_id, kInvokingRelation);
+    for (auto callee_id : Postings(kInvokingPostings, dex_idx, caller_id)) {
       if (!IsMethodMatch(dex_idx, callee_id,
                          return_type == size_t(-1)
                              ? dex::kNoIndex
@@ -406,8 +1384,8 @@ std::vector<size_t> DexHelper::FindMethodInvoking(
                          declaring_class == size_t(-1)
                              ? dex::kNoIndex
                              : class_indices_[declaring_class][dex_idx],
-                         parameter_types_ids[dex_idx],
-                         contains_parameter_types_ids[dex_idx])) {
+                         parameter_types_ids, contains_parameter_types_ids)) {
+        ++query.stats.methods_rejected;
         continue;
       }
       out.emplace_back(CreateMethodIndex(dex_idx, callee_id));
@@ -423,9 +1401,19 @@ std::vector<size_t> DexHelper::FindMethodInvoked(
     std::string_view parameter_shorty, size_t declaring_class,
     const std::vector<size_t> &parameter_types,
     const std::vector<size_t> &contains_parameter_types,
-    const std::vector<size_t> &dex_priority, bool find_first) const {
-
+    const std::vector<size_t> &dex_priority, bool find_first,
+    QueryStats *stats) const {
+  DEX_TRACE("FindMethodInvoked");
+  QueryScope query(*this, kFindMethodInvoked, stats);
+  BudgetGuard budget{*this};
   std::vector<size_t> out;
+  LogScope log(*this, query_log::kFindMethodInvoked, &out);
+  if (log.record) {
+    log.record->target = method_idx;
+    SetFilter(*log.record, return_type, parameter_count, parameter_shorty,
+              declaring_class, parameter_types, contains_parameter_types,
+              dex_priority, find_first);
+  }
 
   if (method_idx >= method_indices_.size())
     return out;
@@ -433,25 +1421,35 @@ std::vector<size_t> DexHelper::FindMethodInvoked(
     return out;
   if (declaring_class != size_t(-1) && declaring_class >= class_indices_.size())
     return out;
-  const auto [parameter_types_ids, contains_parameter_types_ids] =
-      ConvertParameters(parameter_types, contains_parameter_types);
-
-  const auto method_ids = method_indices_[method_idx];
 
+  bool probe = find_first && !(options_.relations & kInvokedRelation);
   for (auto dex_idx : GetPriority(dex_priority)) {
-    auto callee_id = method_ids[dex_idx];
+    Touch(dex_idx);
+    const auto [parameter_types_ids, contains_parameter_types_ids] =
+        ConvertParameters(dex_idx, parameter_types, contains_parameter_types);
+    auto callee_id = method_indices_[method_idx][dex_idx];
     if (callee_id == dex::kNoIndex)
       continue;
-    auto &codes = method_codes_[dex_idx];
-    auto &cache = invoked_cache_[dex_idx][callee_id];
-    if (find_first && !cache.empty()) {
-      out.emplace_back(CreateMethodIndex(dex_idx, cache.front()));
+    auto cache = Postings(kInvokedPostings, dex_idx, callee_id);
+    uint32_t first =
+        find_first ? FirstInCodeOrder(dex_idx, cache) : dex::kNoIndex;
+    if (first != dex::kNoIndex && (dex_scanned_[dex_idx] & kInvokedRelation)) {
+      ++query.stats.cache_hits;
+      out.emplace_back(CreateMethodIndex(dex_idx, first));
       return out;
     }
-    for (size_t method_id = 0; method_id < codes.size(); ++method_id) {
+    PrefetchCode(dex_idx);
+    FaultScope faults(prefetch_stats_.code);
+    DEX_TRACE_ARG("scan_dex", dex_idx);
+    for (auto method_id : method_order_[dex_idx]) {
+      if (method_id == first)
+        break;
       auto &scanned = searched_methods_[dex_idx];
-      if (scanned[method_id])
+      ++query.stats.methods_visited;
+      if (scanned[method_id] & kInvokedRelation) {
+        ++query.stats.cache_hits;
         continue;
+      }
       if (!IsMethodMatch(dex_idx, method_id,
                          return_type == size_t(-1)
                              ? dex::kNoIndex
@@ -460,19 +1458,32 @@ std::vector<size_t> DexHelper::FindMethodInvoked(
                          declaring_class == size_t(-1)
                              ? dex::kNoIndex
                              : class_indices_[declaring_class][dex_idx],
-                         parameter_types_ids[dex_idx],
-                         contains_parameter_types_ids[dex_idx])) {
+                         parameter_types_ids, contains_parameter_types_ids)) {
+        ++query.stats.methods_rejected;
         continue;
       }
-      ScanMethod(dex_idx, method_id);
-      if (find_first && !cache.empty())
+      if (probe) {
+        if (Probe(dex_idx, method_id, kInvokedRelation, callee_id,
+                  callee_id + 1)) {
+          out.emplace_back(CreateMethodIndex(dex_idx, method_id));
+          return out;
+        }
+        continue;
+      }
+      auto hits = Postings(kInvokedPostings, dex_idx, callee_id).size();
+      ScanMethod(dex_idx, method_id, kInvokedRelation);
+      if (find_first &&
+          Postings(kInvokedPostings, dex_idx, callee_id).size() > hits)
         break;
     }
-    for (auto &caller : cache) {
-      out.emplace_back(CreateMethodIndex(dex_idx, caller));
-      if (find_first)
-        return out;
+    cache = Postings(kInvokedPostings, dex_idx, callee_id);
+    if (find_first && !cache.empty()) {
+      out.emplace_back(
+          CreateMethodIndex(dex_idx, FirstInCodeOrder(dex_idx, cache)));
+      return out;
     }
+    for (auto caller : cache)
+      out.emplace_back(CreateMethodIndex(dex_idx, caller));
   }
   return out;
 }
@@ -482,8 +1493,19 @@ std::vector<size_t> DexHelper::FindMethodGettingField(
     std::string_view parameter_shorty, size_t declaring_class,
     const std::vector<size_t> &parameter_types,
     const std::vector<size_t> &contains_parameter_types,
-    const std::vector<size_t> &dex_priority, bool find_first) const {
+    const std::vector<size_t> &dex_priority, bool find_first,
+    QueryStats *stats) const {
+  DEX_TRACE("FindMethodGettingField");
+  QueryScope query(*this, kFindMethodGettingField, stats);
+  BudgetGuard budget{*this};
   std::vector<size_t> out;
+  LogScope log(*this, query_log::kFindMethodGettingField, &out);
+  if (log.record) {
+    log.record->target = field_idx;
+    SetFilter(*log.record, return_type, parameter_count, parameter_shorty,
+              declaring_class, parameter_types, contains_parameter_types,
+              dex_priority, find_first);
+  }
 
   if (field_idx >= field_indices_.size())
     return out;
@@ -491,23 +1513,34 @@ std::vector<size_t> DexHelper::FindMethodGettingField(
     return out;
   if (declaring_class != size_t(-1) && declaring_class >= class_indices_.size())
     return out;
-  const auto [parameter_types_ids, contains_parameter_types_ids] =
-      ConvertParameters(parameter_types, contains_parameter_types);
-  auto field_ids = field_indices_[field_idx];
+  bool probe = find_first && !(options_.relations & kGettingRelation);
   for (auto dex_idx : GetPriority(dex_priority)) {
-    auto field_id = field_ids[dex_idx];
+    Touch(dex_idx);
+    const auto [parameter_types_ids, contains_parameter_types_ids] =
+        ConvertParameters(dex_idx, parameter_types, contains_parameter_types);
+    auto field_id = field_indices_[field_idx][dex_idx];
     if (field_id == dex::kNoIndex)
       continue;
-    auto &codes = method_codes_[dex_idx];
-    auto &cache = getting_cache_[dex_idx][field_id];
-    if (find_first && !cache.empty()) {
-      out.emplace_back(CreateMethodIndex(dex_idx, cache.front()));
+    auto cache = Postings(kGettingPostings, dex_idx, field_id);
+    uint32_t first =
+        find_first ? FirstInCodeOrder(dex_idx, cache) : dex::kNoIndex;
+    if (first != dex::kNoIndex && (dex_scanned_[dex_idx] & kGettingRelation)) {
+      ++query.stats.cache_hits;
+      out.emplace_back(CreateMethodIndex(dex_idx, first));
       return out;
     }
-    for (size_t method_id = 0; method_id < codes.size(); ++method_id) {
+    PrefetchCode(dex_idx);
+    FaultScope faults(prefetch_stats_.code);
+    DEX_TRACE_ARG("scan_dex", dex_idx);
+    for (auto method_id : method_order_[dex_idx]) {
+      if (method_id == first)
+        break;
       auto &scanned = searched_methods_[dex_idx];
-      if (scanned[method_id])
+      ++query.stats.methods_visited;
+      if (scanned[method_id] & kGettingRelation) {
+        ++query.stats.cache_hits;
         continue;
+      }
       if (!IsMethodMatch(dex_idx, method_id,
                          return_type == size_t(-1)
                              ? dex::kNoIndex
@@ -516,19 +1549,32 @@ std::vector<size_t> DexHelper::FindMethodGettingField(
                          declaring_class == size_t(-1)
                              ? dex::kNoIndex
                              : class_indices_[declaring_class][dex_idx],
-                         parameter_types_ids[dex_idx],
-                         contains_parameter_types_ids[dex_idx])) {
+                         parameter_types_ids, contains_parameter_types_ids)) {
+        ++query.stats.methods_rejected;
+        continue;
+      }
+      if (probe) {
+        if (Probe(dex_idx, method_id, kGettingRelation, field_id,
+                  field_id + 1)) {
+          out.emplace_back(CreateMethodIndex(dex_idx, method_id));
+          return out;
+        }
         continue;
       }
-      ScanMethod(dex_idx, method_id);
-      if (find_first && !cache.empty())
+      auto hits = Postings(kGettingPostings, dex_idx, field_id).size();
+      ScanMethod(dex_idx, method_id, kGettingRelation);
+      if (find_first &&
+          Postings(kGettingPostings, dex_idx, field_id).size() > hits)
         break;
     }
-    for (auto &getter : cache) {
-      out.emplace_back(CreateMethodIndex(dex_idx, getter));
-      if (find_first)
-        return out;
+    cache = Postings(kGettingPostings, dex_idx, field_id);
+    if (find_first && !cache.empty()) {
+      out.emplace_back(
+          CreateMethodIndex(dex_idx, FirstInCodeOrder(dex_idx, cache)));
+      return out;
     }
+    for (auto getter : cache)
+      out.emplace_back(CreateMethodIndex(dex_idx, getter));
   }
   return out;
 }
@@ -538,8 +1584,19 @@ std::vector<size_t> DexHelper::FindMethodSettingField(
     std::string_view parameter_shorty, size_t declaring_class,
     const std::vector<size_t> &parameter_types,
     const std::vector<size_t> &contains_parameter_types,
-    const std::vector<size_t> &dex_priority, bool find_first) const {
+    const std::vector<size_t> &dex_priority, bool find_first,
+    QueryStats *stats) const {
+  DEX_TRACE("FindMethodSettingField");
+  QueryScope query(*this, kFindMethodSettingField, stats);
+  BudgetGuard budget{*this};
   std::vector<size_t> out;
+  LogScope log(*this, query_log::kFindMethodSettingField, &out);
+  if (log.record) {
+    log.record->target = field_idx;
+    SetFilter(*log.record, return_type, parameter_count, parameter_shorty,
+              declaring_class, parameter_types, contains_parameter_types,
+              dex_priority, find_first);
+  }
 
   if (field_idx >= field_indices_.size())
     return out;
@@ -547,23 +1604,34 @@ std::vector<size_t> DexHelper::FindMethodSettingField(
     return out;
   if (declaring_class != size_t(-1) && declaring_class >= class_indices_.size())
     return out;
-  const auto [parameter_types_ids, contains_parameter_types_ids] =
-      ConvertParameters(parameter_types, contains_parameter_types);
-  auto field_ids = field_indices_[field_idx];
+  bool probe = find_first && !(options_.relations & kSettingRelation);
   for (auto dex_idx : GetPriority(dex_priority)) {
-    auto field_id = field_ids[dex_idx];
+    Touch(dex_idx);
+    const auto [parameter_types_ids, contains_parameter_types_ids] =
+        ConvertParameters(dex_idx, parameter_types, contains_parameter_types);
+    auto field_id = field_indices_[field_idx][dex_idx];
     if (field_id == dex::kNoIndex)
       continue;
-    auto &codes = method_codes_[dex_idx];
-    auto &cache = setting_cache_[dex_idx][field_id];
-    if (find_first && !cache.empty()) {
-      out.emplace_back(CreateMethodIndex(dex_idx, cache.front()));
+    auto cache = Postings(kSettingPostings, dex_idx, field_id);
+    uint32_t first =
+        find_first ? FirstInCodeOrder(dex_idx, cache) : dex::kNoIndex;
+    if (first != dex::kNoIndex && (dex_scanned_[dex_idx] & kSettingRelation)) {
+      ++query.stats.cache_hits;
+      out.emplace_back(CreateMethodIndex(dex_idx, first));
       return out;
     }
-    for (size_t method_id = 0; method_id < codes.size(); ++method_id) {
+    PrefetchCode(dex_idx);
+    FaultScope faults(prefetch_stats_.code);
+    DEX_TRACE_ARG("scan_dex", dex_idx);
+    for (auto method_id : method_order_[dex_idx]) {
+      if (method_id == first)
+        break;
       auto &scanned = searched_methods_[dex_idx];
-      if (scanned[method_id])
+      ++query.stats.methods_visited;
+      if (scanned[method_id] & kSettingRelation) {
+        ++query.stats.cache_hits;
         continue;
+      }
       if (!IsMethodMatch(dex_idx, method_id,
                          return_type == size_t(-1)
                              ? dex::kNoIndex
@@ -572,31 +1640,55 @@ std::vector<size_t> DexHelper::FindMethodSettingField(
                          declaring_class == size_t(-1)
                              ? dex::kNoIndex
                              : class_indices_[declaring_class][dex_idx],
-                         parameter_types_ids[dex_idx],
-                         contains_parameter_types_ids[dex_idx])) {
+                         parameter_types_ids, contains_parameter_types_ids)) {
+        ++query.stats.methods_rejected;
         continue;
       }
-      ScanMethod(dex_idx, method_id);
-      if (find_first && !cache.empty())
+      if (probe) {
+        if (Probe(dex_idx, method_id, kSettingRelation, field_id,
+                  field_id + 1)) {
+          out.emplace_back(CreateMethodIndex(dex_idx, method_id));
+          return out;
+        }
+        continue;
+      }
+      auto hits = Postings(kSettingPostings, dex_idx, field_id).size();
+      ScanMethod(dex_idx, method_id, kSettingRelation);
+      if (find_first &&
+          Postings(kSettingPostings, dex_idx, field_id).size() > hits)
         break;
     }
-    for (auto &getter : cache) {
-      out.emplace_back(CreateMethodIndex(dex_idx, getter));
-      if (find_first)
-        return out;
+    cache = Postings(kSettingPostings, dex_idx, field_id);
+    if (find_first && !cache.empty()) {
+      out.emplace_back(
+          CreateMethodIndex(dex_idx, FirstInCodeOrder(dex_idx, cache)));
+      return out;
     }
+    for (auto getter : cache)
+      out.emplace_back(CreateMethodIndex(dex_idx, getter));
   }
   return out;
 }
 std::vector<size_t>
 DexHelper::FindField(size_t type, const std::vector<size_t> &dex_priority,
-                     bool find_first) const {
+                     bool find_first, QueryStats *stats) const {
+  DEX_TRACE("FindField");
+  QueryScope query(*this, kFindField, stats);
   std::vector<size_t> out;
+  LogScope log(*this, query_log::kFindField, &out);
+  if (log.record) {
+    log.record->target = type;
+    log.record->dex_priority = dex_priority;
+    log.record->find_first = find_first;
+  }
 
   if (type >= class_indices_.size())
     return out;
   auto &type_ids = class_indices_[type];
   for (auto dex_idx : GetPriority(dex_priority)) {
+    Touch(dex_idx);
+    if (type_ids[dex_idx] == dex::kNoIndex)
+      continue;
     for (auto &field_id : declaring_cache_[dex_idx][type_ids[dex_idx]]) {
       out.emplace_back(CreateFieldIndex(dex_idx, field_id));
       if (find_first)
@@ -606,6 +1698,265 @@ DexHelper::FindField(size_t type, const std::vector<size_t> &dex_priority,
   return out;
 }
 
+auto DexHelper::MethodSet::operator&=(const MethodSet &other) -> MethodSet & {
+  dexes.resize(std::min(dexes.size(), other.dexes.size()));
+  for (size_t dex_idx = 0; dex_idx < dexes.size(); ++dex_idx)
+    dexes[dex_idx] &= other.dexes[dex_idx];
+  return *this;
+}
+
+auto DexHelper::MethodSet::operator|=(const MethodSet &other) -> MethodSet & {
+  dexes.resize(std::max(dexes.size(), other.dexes.size()));
+  for (size_t dex_idx = 0; dex_idx < other.dexes.size(); ++dex_idx)
+    dexes[dex_idx] |= other.dexes[dex_idx];
+  return *this;
+}
+
+auto DexHelper::MethodSet::operator-=(const MethodSet &other) -> MethodSet & {
+  for (size_t dex_idx = 0;
+       dex_idx < dexes.size() && dex_idx < other.dexes.size(); ++dex_idx)
+    dexes[dex_idx] -= other.dexes[dex_idx];
+  return *this;
+}
+
+bool DexHelper::MethodSet::empty() const {
+  return std::all_of(dexes.begin(), dexes.end(),
+                     [](const RoaringSet &set) { return set.empty(); });
+}
+
+size_t DexHelper::MethodSet::size() const {
+  size_t size = 0;
+  for (auto &set : dexes)
+    size += set.size();
+  return size;
+}
+
+std::vector<size_t> DexHelper::MethodSet::Flatten() const {
+  std::vector<size_t> out;
+  for (auto &set : dexes) {
+    out.emplace_back(set.size());
+    set.ForEach([&out](uint32_t method_id) { out.emplace_back(method_id); });
+  }
+  return out;
+}
+
+auto DexHelper::PostingSet(PostingTable table,
+                           const std::vector<std::vector<uint32_t>> &indices,
+                           size_t index) const -> MethodSet {
+  MethodSet out;
+  out.dexes.resize(readers_.size());
+  if (index >= indices.size())
+    return out;
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    Touch(dex_idx);
+    auto id = indices[index][dex_idx];
+    if (id == dex::kNoIndex)
+      continue;
+    ScanDex(dex_idx, 1u << table);
+    auto postings = Postings(table, dex_idx, id);
+    out.dexes[dex_idx] =
+        RoaringSet(std::vector<uint32_t>(postings.begin(), postings.end()));
+  }
+  return out;
+}
+
+auto DexHelper::FindMethodSetUsingString(std::string_view str,
+                                         bool match_prefix,
+                                         QueryStats *stats) const
+    -> MethodSet {
+  DEX_TRACE("FindMethodSetUsingString");
+  QueryScope query(*this, kFindMethodSetUsingString, stats);
+  BudgetGuard budget{*this};
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetUsingString, &out);
+  if (log.record) {
+    log.record->str = str;
+    log.record->match_prefix = match_prefix;
+  }
+  out.dexes.resize(readers_.size());
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    if (removed_[dex_idx])
+      continue;
+    uint32_t lower, upper;
+    if (match_prefix) {
+      std::tie(lower, upper) = FindPrefixStringId(dex_idx, str);
+    } else {
+      lower = upper = FindPrefixStringIdExact(dex_idx, str);
+      ++upper;
+    }
+    if (lower == dex::kNoIndex)
+      continue;
+    Touch(dex_idx);
+    ScanDex(dex_idx, kStringRelation);
+    std::vector<uint32_t> ids;
+    for (auto s = lower; s < upper; ++s) {
+      for (auto m : Postings(kStringPostings, dex_idx, s))
+        ids.emplace_back(m);
+    }
+    out.dexes[dex_idx] = RoaringSet(ids);
+  }
+  return out;
+}
+
+auto DexHelper::FindMethodSetInvoking(size_t method_idx,
+                                      QueryStats *stats) const -> MethodSet {
+  DEX_TRACE("FindMethodSetInvoking");
+  QueryScope query(*this, kFindMethodSetInvoking, stats);
+  BudgetGuard budget{*this};
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetInvoking, &out);
+  if (log.record)
+    log.record->target = method_idx;
+  out.dexes.resize(readers_.size());
+  if (method_idx >= method_indices_.size())
+    return out;
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    Touch(dex_idx);
+    auto caller_id = method_indices_[method_idx][dex_idx];
+    if (caller_id == dex::kNoIndex)
+      continue;
+    ScanMethod(dex_idx, caller_id, kInvokingRelation);
+    auto callees = Postings(kInvokingPostings, dex_idx, caller_id);
+    out.dexes[dex_idx] =
+        RoaringSet(std::vector<uint32_t>(callees.begin(), callees.end()));
+  }
+  return out;
+}
+
+auto DexHelper::FindMethodSetInvoked(size_t method_idx,
+                                     QueryStats *stats) const -> MethodSet {
+  DEX_TRACE("FindMethodSetInvoked");
+  QueryScope query(*this, kFindMethodSetInvoked, stats);
+  BudgetGuard budget{*this};
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetInvoked, &out);
+  if (log.record)
+    log.record->target = method_idx;
+  out = PostingSet(kInvokedPostings, method_indices_, method_idx);
+  return out;
+}
+
+auto DexHelper::FindMethodSetGettingField(size_t field_idx,
+                                          QueryStats *stats) const
+    -> MethodSet {
+  DEX_TRACE("FindMethodSetGettingField");
+  QueryScope query(*this, kFindMethodSetGettingField, stats);
+  BudgetGuard budget{*this};
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetGettingField, &out);
+  if (log.record)
+    log.record->target = field_idx;
+  out = PostingSet(kGettingPostings, field_indices_, field_idx);
+  return out;
+}
+
+auto DexHelper::FindMethodSetSettingField(size_t field_idx,
+                                          QueryStats *stats) const
+    -> MethodSet {
+  DEX_TRACE("FindMethodSetSettingField");
+  QueryScope query(*this, kFindMethodSetSettingField, stats);
+  BudgetGuard budget{*this};
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetSettingField, &out);
+  if (log.record)
+    log.record->target = field_idx;
+  out = PostingSet(kSettingPostings, field_indices_, field_idx);
+  return out;
+}
+
+auto DexHelper::FindMethodSetOfClass(size_t class_idx,
+                                     QueryStats *stats) const -> MethodSet {
+  DEX_TRACE("FindMethodSetOfClass");
+  QueryScope query(*this, kFindMethodSetOfClass, stats);
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetOfClass, &out);
+  if (log.record)
+    log.record->target = class_idx;
+  out.dexes.resize(readers_.size());
+  if (class_idx >= class_indices_.size())
+    return out;
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    Touch(dex_idx);
+    auto class_id = class_indices_[class_idx][dex_idx];
+    if (class_id == dex::kNoIndex)
+      continue;
+    std::vector<uint32_t> ids;
+    for (auto &[name, method_ids] : method_cache_[dex_idx][class_id])
+      ids.insert(ids.end(), method_ids.begin(), method_ids.end());
+    out.dexes[dex_idx] = RoaringSet(ids);
+  }
+  return out;
+}
+
+auto DexHelper::FindMethodSetMatching(
+    size_t return_type, short parameter_count,
+    std::string_view parameter_shorty, size_t declaring_class,
+    const std::vector<size_t> &parameter_types,
+    const std::vector<size_t> &contains_parameter_types,
+    QueryStats *stats) const -> MethodSet {
+  DEX_TRACE("FindMethodSetMatching");
+  QueryScope query(*this, kFindMethodSetMatching, stats);
+  MethodSet out;
+  LogScope log(*this, query_log::kFindMethodSetMatching, &out);
+  if (log.record) {
+    SetFilter(*log.record, return_type, parameter_count, parameter_shorty,
+              declaring_class, parameter_types, contains_parameter_types, {},
+              false);
+  }
+  out.dexes.resize(readers_.size());
+  if (return_type != size_t(-1) && return_type >= class_indices_.size())
+    return out;
+  if (declaring_class != size_t(-1) && declaring_class >= class_indices_.size())
+    return out;
+  for (size_t dex_idx = 0; dex_idx < readers_.size(); ++dex_idx) {
+    if (removed_[dex_idx])
+      continue;
+    Touch(dex_idx);
+    const auto [parameter_types_ids, contains_parameter_types_ids] =
+        ConvertParameters(dex_idx, parameter_types, contains_parameter_types);
+    uint32_t return_type_id = return_type == size_t(-1)
+                                  ? dex::kNoIndex
+                                  : class_indices_[return_type][dex_idx];
+    uint32_t declaring_class_id =
+        declaring_class == size_t(-1)
+            ? dex::kNoIndex
+            : class_indices_[declaring_class][dex_idx];
+    // IsMethodMatch takes kNoIndex for no constraint, but a class the dex
+    // lacks matches none of its methods
+    if ((return_type != size_t(-1) && return_type_id == dex::kNoIndex) ||
+        (declaring_class != size_t(-1) && declaring_class_id == dex::kNoIndex))
+      continue;
+    auto &set = out.dexes[dex_idx];
+    for (uint32_t method_id = 0;
+         method_id < readers_[dex_idx].MethodIds().size(); ++method_id) {
+      ++query.stats.methods_visited;
+      if (IsMethodMatch(dex_idx, method_id, return_type_id, parameter_count,
+                        parameter_shorty, declaring_class_id,
+                        parameter_types_ids, contains_parameter_types_ids))
+        set.Add(method_id);
+      else
+        ++query.stats.methods_rejected;
+    }
+  }
+  return out;
+}
+
+std::vector<size_t> DexHelper::MethodIndices(const MethodSet &set) const {
+  std::vector<size_t> out;
+  for (size_t dex_idx = 0;
+       dex_idx < set.dexes.size() && dex_idx < readers_.size(); ++dex_idx) {
+    // a set made before its dex was removed
+    if (removed_[dex_idx])
+      continue;
+    set.dexes[dex_idx].ForEach([&](uint32_t method_id) {
+      out.emplace_back(CreateMethodIndex(dex_idx, method_id));
+    });
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return out;
+}
+
 bool DexHelper::IsMethodMatch(
     size_t dex_id, uint32_t method_id, uint32_t return_type,
     short parameter_count, std::string_view parameter_shorty,
@@ -613,18 +1964,17 @@ bool DexHelper::IsMethodMatch(
     const std::vector<uint32_t> &contains_parameter_types) const {
   auto &dex = readers_[dex_id];
   auto &method = dex.MethodIds()[method_id];
-  auto &strs = strings_[dex_id];
   auto &params = method_params_[dex_id][method_id];
   size_t params_size = params ? params->size : 0;
   if (declaring_class != dex::kNoIndex && method.class_idx != declaring_class)
     return false;
   auto &proto = dex.ProtoIds()[method.proto_idx];
-  auto &shorty = strs[proto.shorty_idx];
   if (return_type != dex::kNoIndex && proto.return_type_idx != return_type)
     return false;
-  if (!parameter_shorty.empty() && shorty != parameter_shorty)
+  if (!parameter_shorty.empty() &&
+      String(dex_id, proto.shorty_idx) != parameter_shorty)
     return false;
-  if (parameter_count != -1 && params_size != parameter_count)
+  if (parameter_count != -1 && params_size != size_t(parameter_count))
     return false;
   if (!parameter_types.empty()) {
     if (parameter_types.size() != params_size)
@@ -652,47 +2002,58 @@ bool DexHelper::IsMethodMatch(
 size_t DexHelper::CreateMethodIndex(
     std::string_view class_name, std::string_view method_name,
     const std::vector<std::string_view> &params_name, size_t on_dex) const {
+  LogScope log(*this, query_log::kCreateMethodIndex);
+  if (log.record) {
+    log.record->class_name = class_name;
+    log.record->member_name = method_name;
+    log.record->params_name.assign(params_name.begin(), params_name.end());
+    log.record->on_dex = on_dex;
+  }
   std::vector<uint32_t> method_ids;
   method_ids.resize(readers_.size(), dex::kNoIndex);
-  for (size_t dex_idx = size_t(-1);
-       dex_idx < readers_.size() || dex_idx == size_t(-1); ++dex_idx) {
-    if (dex_idx == size_t(-1)) {
-      dex_idx = on_dex;
-    }
-    if (dex_idx == size_t(-1)) {
-      dex_idx = 0;
-    }
-    auto &strs = strings_[dex_idx];
-    auto method_name_iter =
-        std::lower_bound(strs.cbegin(), strs.cend(), method_name);
-    if (method_name_iter == strs.cend() || *method_name_iter != method_name)
-      continue;
-    auto method_name_id = method_name_iter - strs.cbegin();
-    auto class_name_iter =
-        std::lower_bound(strs.cbegin(), strs.cend(), class_name);
-    if (class_name_iter == strs.cend() || *class_name_iter != class_name)
-      continue;
-    auto class_name_id = class_name_iter - strs.cbegin();
-    auto class_id = type_cache_[dex_idx][class_name_id];
-    auto candidates = method_cache_[dex_idx][class_id].find(method_name_id);
-    if (candidates == method_cache_[dex_idx][class_id].end())
-      continue;
-    for (auto &method_id : candidates->second) {
-      auto &dex = readers_[dex_idx];
-      auto params = method_params_[dex_idx][method_id];
-      if (params && params->size != params_name.size())
+  for (bool later : {false, true}) {
+    for (size_t dex_idx = size_t(-1);
+         dex_idx < readers_.size() || dex_idx == size_t(-1); ++dex_idx) {
+      if (dex_idx == size_t(-1)) {
+        dex_idx = on_dex;
+      }
+      if (dex_idx == size_t(-1)) {
+        dex_idx = 0;
+      }
+      if (dex_idx >= readers_.size() || removed_[dex_idx] ||
+          prepared_[dex_idx] == later)
+        continue;
+      auto method_name_id = FindPrefixStringIdExact(dex_idx, method_name);
+      if (method_name_id == dex::kNoIndex)
+        continue;
+      auto class_name_id = FindPrefixStringIdExact(dex_idx, class_name);
+      if (class_name_id == dex::kNoIndex)
         continue;
-      if (!params_name.empty() && !params)
+      Prepare(dex_idx);
+      auto class_id = type_cache_[dex_idx][class_name_id];
+      auto candidates = method_cache_[dex_idx][class_id].find(method_name_id);
+      if (candidates == method_cache_[dex_idx][class_id].end())
         continue;
-      for (size_t i = 0; i < params_name.size(); ++i) {
-        if (strs[dex.TypeIds()[params->list[i].type_idx].descriptor_idx] !=
-            params_name[i])
+      for (auto &method_id : candidates->second) {
+        auto params = method_params_[dex_idx][method_id];
+        if (params && params->size != params_name.size())
           continue;
+        if (!params_name.empty() && !params)
+          continue;
+        for (size_t i = 0; i < params_name.size(); ++i) {
+          if (TypeName(dex_idx, params->list[i].type_idx) != params_name[i])
+            continue;
+        }
+        if (auto idx = rev_method_indices_[dex_idx][method_id];
+            idx != size_t(-1))
+          return log.Return(idx);
+        method_ids[dex_idx] = method_id;
       }
-      if (auto idx = rev_method_indices_[dex_idx][method_id]; idx != size_t(-1))
-        return idx;
-      method_ids[dex_idx] = method_id;
+      if (later && method_ids[dex_idx] != dex::kNoIndex)
+        break;
     }
+    if (Resolved(method_ids))
+      break;
   }
   auto index = method_indices_.size();
   for (size_t dex_id = 0; dex_id < readers_.size(); ++dex_id) {
@@ -701,31 +2062,45 @@ size_t DexHelper::CreateMethodIndex(
       rev_method_indices_[dex_id][method_id] = index;
   }
   method_indices_.emplace_back(std::move(method_ids));
-  return index;
+  if (query_stats_)
+    ++query_stats_->indices_created;
+  return log.Return(index);
 }
 
 size_t DexHelper::CreateClassIndex(std::string_view class_name,
                                    size_t on_dex) const {
+  LogScope log(*this, query_log::kCreateClassIndex);
+  if (log.record) {
+    log.record->class_name = class_name;
+    log.record->on_dex = on_dex;
+  }
   std::vector<uint32_t> class_ids;
   class_ids.resize(readers_.size(), dex::kNoIndex);
-  for (size_t dex_idx = size_t(-1);
-       dex_idx < readers_.size() || dex_idx == size_t(-1); ++dex_idx) {
-    if (dex_idx == size_t(-1)) {
-      dex_idx = on_dex;
-    }
-    if (dex_idx == size_t(-1)) {
-      dex_idx = 0;
+  for (bool later : {false, true}) {
+    for (size_t dex_idx = size_t(-1);
+         dex_idx < readers_.size() || dex_idx == size_t(-1); ++dex_idx) {
+      if (dex_idx == size_t(-1)) {
+        dex_idx = on_dex;
+      }
+      if (dex_idx == size_t(-1)) {
+        dex_idx = 0;
+      }
+      if (dex_idx >= readers_.size() || removed_[dex_idx] ||
+          prepared_[dex_idx] == later)
+        continue;
+      auto class_name_id = FindPrefixStringIdExact(dex_idx, class_name);
+      if (class_name_id == dex::kNoIndex)
+        continue;
+      Prepare(dex_idx);
+      auto class_id = type_cache_[dex_idx][class_name_id];
+      if (auto idx = rev_class_indices_[dex_idx][class_id]; idx != size_t(-1))
+        return log.Return(idx);
+      class_ids[dex_idx] = class_id;
+      if (later)
+        break;
     }
-    auto &strs = strings_[dex_idx];
-    auto class_name_iter =
-        std::lower_bound(strs.cbegin(), strs.cend(), class_name);
-    if (class_name_iter == strs.cend() || *class_name_iter != class_name)
-      continue;
-    auto class_name_id = class_name_iter - strs.cbegin();
-    auto class_id = type_cache_[dex_idx][class_name_id];
-    if (auto idx = rev_class_indices_[dex_idx][class_id]; idx != size_t(-1))
-      return idx;
-    class_ids[dex_idx] = class_id;
+    if (Resolved(class_ids))
+      break;
   }
 
   auto index = class_indices_.size();
@@ -735,42 +2110,55 @@ size_t DexHelper::CreateClassIndex(std::string_view class_name,
       rev_class_indices_[dex_id][class_id] = index;
   }
   class_indices_.emplace_back(std::move(class_ids));
-  return index;
+  if (query_stats_)
+    ++query_stats_->indices_created;
+  return log.Return(index);
 }
 
 size_t DexHelper::CreateFieldIndex(std::string_view class_name,
                                    std::string_view field_name,
                                    size_t on_dex) const {
+  LogScope log(*this, query_log::kCreateFieldIndex);
+  if (log.record) {
+    log.record->class_name = class_name;
+    log.record->member_name = field_name;
+    log.record->on_dex = on_dex;
+  }
   std::vector<uint32_t> field_ids;
   field_ids.resize(readers_.size(), dex::kNoIndex);
 
-  for (size_t dex_idx = size_t(-1);
-       dex_idx < readers_.size() || dex_idx == size_t(-1); ++dex_idx) {
-    if (dex_idx == size_t(-1)) {
-      dex_idx = on_dex;
-    }
-    if (dex_idx == size_t(-1)) {
-      dex_idx = 0;
+  for (bool later : {false, true}) {
+    for (size_t dex_idx = size_t(-1);
+         dex_idx < readers_.size() || dex_idx == size_t(-1); ++dex_idx) {
+      if (dex_idx == size_t(-1)) {
+        dex_idx = on_dex;
+      }
+      if (dex_idx == size_t(-1)) {
+        dex_idx = 0;
+      }
+      if (dex_idx >= readers_.size() || removed_[dex_idx] ||
+          prepared_[dex_idx] == later)
+        continue;
+      auto class_name_id = FindPrefixStringIdExact(dex_idx, class_name);
+      if (class_name_id == dex::kNoIndex)
+        continue;
+      auto field_name_id = FindPrefixStringIdExact(dex_idx, field_name);
+      if (field_name_id == dex::kNoIndex)
+        continue;
+      Prepare(dex_idx);
+      auto class_id = type_cache_[dex_idx][class_name_id];
+      auto iter = field_cache_[dex_idx][class_id].find(field_name_id);
+      if (iter == field_cache_[dex_idx][class_id].end())
+        continue;
+      auto field_id = iter->second;
+      if (auto idx = rev_field_indices_[dex_idx][field_id]; idx != size_t(-1))
+        return log.Return(idx);
+      field_ids[dex_idx] = field_id;
+      if (later)
+        break;
     }
-    auto &strs = strings_[dex_idx];
-    auto class_name_iter =
-        std::lower_bound(strs.cbegin(), strs.cend(), class_name);
-    if (class_name_iter == strs.cend() || *class_name_iter != class_name)
-      continue;
-    auto class_name_id = class_name_iter - strs.cbegin();
-    auto field_name_iter =
-        std::lower_bound(strs.cbegin(), strs.cend(), field_name);
-    if (field_name_iter == strs.cend() || *field_name_iter != field_name)
-      continue;
-    auto field_name_id = field_name_iter - strs.cbegin();
-    auto class_id = type_cache_[dex_idx][class_name_id];
-    auto iter = field_cache_[dex_idx][class_id].find(field_name_id);
-    if (iter == field_cache_[dex_idx][class_id].end())
-      continue;
-    auto field_id = iter->second;
-    if (auto idx = rev_field_indices_[dex_idx][field_id]; idx != size_t(-1))
-      return idx;
-    field_ids[dex_idx] = field_id;
+    if (Resolved(field_ids))
+      break;
   }
 
   auto index = field_indices_.size();
@@ -780,39 +2168,84 @@ size_t DexHelper::CreateFieldIndex(std::string_view class_name,
       rev_field_indices_[dex_id][field_id] = index;
   }
   field_indices_.emplace_back(std::move(field_ids));
-  return index;
+  if (query_stats_)
+    ++query_stats_->indices_created;
+  return log.Return(index);
 }
 
 size_t DexHelper::CreateMethodIndex(size_t dex_idx, uint32_t method_id) const {
   auto &dex = readers_[dex_idx];
-  auto &strs = strings_[dex_idx];
   auto &method = dex.MethodIds()[method_id];
   auto &params = method_params_[dex_idx][method_id];
   std::vector<std::string_view> param_names;
   if (params) {
     param_names.reserve(params->size);
     for (size_t i = 0; i < params->size; ++i) {
-      param_names.emplace_back(
-          strs[dex.TypeIds()[params->list[i].type_idx].descriptor_idx]);
+      param_names.emplace_back(TypeName(dex_idx, params->list[i].type_idx));
     }
   }
-  return CreateMethodIndex(strs[dex.TypeIds()[method.class_idx].descriptor_idx],
-                           strs[method.name_idx], param_names);
+  return CreateMethodIndex(TypeName(dex_idx, method.class_idx),
+                           String(dex_idx, method.name_idx), param_names);
 }
 
 size_t DexHelper::CreateClassIndex(size_t dex_idx, uint32_t class_id) const {
-  auto &dex = readers_[dex_idx];
-  auto &strs = strings_[dex_idx];
-  return CreateClassIndex(strs[dex.TypeIds()[class_id].descriptor_idx],
-                          dex_idx);
+  return CreateClassIndex(TypeName(dex_idx, class_id), dex_idx);
 }
 
 size_t DexHelper::CreateFieldIndex(size_t dex_idx, uint32_t field_id) const {
   auto &dex = readers_[dex_idx];
-  auto &strs = strings_[dex_idx];
   auto &field = dex.FieldIds()[field_id];
-  return CreateFieldIndex(strs[dex.TypeIds()[field.class_idx].descriptor_idx],
-                          strs[field.name_idx], dex_idx);
+  return CreateFieldIndex(TypeName(dex_idx, field.class_idx),
+                          String(dex_idx, field.name_idx), dex_idx);
+}
+
+uint32_t DexHelper::FindClassId(size_t dex_idx,
+                                std::string_view class_name) const {
+  if (class_name.empty())
+    return dex::kNoIndex;
+  auto class_name_id = FindPrefixStringIdExact(dex_idx, class_name);
+  if (class_name_id == dex::kNoIndex)
+    return dex::kNoIndex;
+  Prepare(dex_idx);
+  return type_cache_[dex_idx][class_name_id];
+}
+
+uint32_t DexHelper::FindMethodId(size_t dex_idx, const Method &method) const {
+  auto class_id = FindClassId(dex_idx, method.declaring_class.name);
+  if (class_id == dex::kNoIndex)
+    return dex::kNoIndex;
+  auto method_name_id = FindPrefixStringIdExact(dex_idx, method.name);
+  if (method_name_id == dex::kNoIndex)
+    return dex::kNoIndex;
+  auto candidates = method_cache_[dex_idx][class_id].find(method_name_id);
+  if (candidates == method_cache_[dex_idx][class_id].end())
+    return dex::kNoIndex;
+  for (auto method_id : candidates->second) {
+    auto params = method_params_[dex_idx][method_id];
+    size_t params_size = params ? params->size : 0;
+    if (params_size != method.parameters.size())
+      continue;
+    size_t i = 0;
+    while (i < params_size &&
+           TypeName(dex_idx, params->list[i].type_idx) ==
+               method.parameters[i].name)
+      ++i;
+    if (i == params_size)
+      return method_id;
+  }
+  return dex::kNoIndex;
+}
+
+uint32_t DexHelper::FindFieldId(size_t dex_idx, const Field &field) const {
+  auto class_id = FindClassId(dex_idx, field.declaring_class.name);
+  if (class_id == dex::kNoIndex)
+    return dex::kNoIndex;
+  auto field_name_id = FindPrefixStringIdExact(dex_idx, field.name);
+  if (field_name_id == dex::kNoIndex)
+    return dex::kNoIndex;
+  auto iter = field_cache_[dex_idx][class_id].find(field_name_id);
+  return iter == field_cache_[dex_idx][class_id].end() ? dex::kNoIndex
+                                                       : iter->second;
 }
 
 auto DexHelper::DecodeClass(size_t class_idx) const -> Class {
@@ -824,8 +2257,7 @@ auto DexHelper::DecodeClass(size_t class_idx) const -> Class {
     if (class_id == dex::kNoIndex)
       continue;
     return {
-        .name = strings_[dex_idx]
-                        [readers_[dex_idx].TypeIds()[class_id].descriptor_idx],
+        .name = TypeName(dex_idx, class_id),
     };
   }
   return {};
@@ -841,14 +2273,13 @@ auto DexHelper::DecodeField(size_t field_idx) const -> Field {
       continue;
     auto &dex = readers_[dex_idx];
     auto &field = dex.FieldIds()[field_id];
-    auto &strs = strings_[dex_idx];
     return {
         .declaring_class =
             {
-                .name = strs[dex.TypeIds()[field.class_idx].descriptor_idx],
+                .name = TypeName(dex_idx, field.class_idx),
             },
-        .type = {.name = strs[dex.TypeIds()[field.type_idx].descriptor_idx]},
-        .name = strings_[dex_idx][field.name_idx],
+        .type = {.name = TypeName(dex_idx, field.type_idx)},
+        .name = String(dex_idx, field.name_idx),
     };
   }
   return {};
@@ -864,26 +2295,24 @@ auto DexHelper::DecodeMethod(size_t method_idx) const -> Method {
       continue;
     auto &dex = readers_[dex_idx];
     auto &method = dex.MethodIds()[method_id];
-    auto &strs = strings_[dex_idx];
     std::vector<Class> parameters;
     auto &params = method_params_[dex_idx][method_id];
     size_t params_size = params ? params->size : 0;
     for (size_t i = 0; i < params_size; ++i) {
       parameters.emplace_back(Class{
-          .name = strs[dex.TypeIds()[params->list[i].type_idx].descriptor_idx],
+          .name = TypeName(dex_idx, params->list[i].type_idx),
       });
     }
     return {
         .declaring_class =
             {
-                .name = strs[dex.TypeIds()[method.class_idx].descriptor_idx],
+                .name = TypeName(dex_idx, method.class_idx),
             },
-        .name = strs[method.name_idx],
+        .name = String(dex_idx, method.name_idx),
         .parameters = std::move(parameters),
-        .return_type = {
-            .name = strs
-                [dex.TypeIds()[dex.ProtoIds()[method.proto_idx].return_type_idx]
-                     .descriptor_idx]}};
+        .return_type = {.name = TypeName(
+                            dex_idx,
+                            dex.ProtoIds()[method.proto_idx].return_type_idx)}};
   }
   return {};
 };
@@ -893,11 +2322,12 @@ DexHelper::GetPriority(const std::vector<size_t> &priority) const {
   std::vector<size_t> out;
   if (priority.empty()) {
     for (size_t i = 0; i < readers_.size(); ++i) {
-      out.emplace_back(i);
+      if (!removed_[i])
+        out.emplace_back(i);
     }
   } else {
     for (auto &i : priority) {
-      if (i < readers_.size()) {
+      if (i < readers_.size() && !removed_[i]) {
         out.emplace_back(i);
       }
     }
@@ -1,52 +1,232 @@
 #pragma once
 
+#include "index_file.h"
+#include "perf_counters.h"
+#include "posting_list.h"
+#include "query_log.h"
+#include "roaring_set.h"
+#include "string_index.h"
+#include "slicer/chronometer.h"
 #include "slicer/reader.h"
+#include <array>
+#include <optional>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
 class DexHelper {
 public:
-  DexHelper(const std::vector<std::tuple<const void *, size_t>> &dexs);
-  void CreateFullCache() const;
+  // Relations between methods and the strings, methods and fields their
+  // code refers to, one bit per search result cache.
+  enum Relation : unsigned {
+    // the strings a method loads
+    kStringRelation = 1 << 0,
+    // the methods a method invokes, and the methods invoking a method
+    kInvokingRelation = 1 << 1,
+    kInvokedRelation = 1 << 2,
+    // the fields a method reads and writes
+    kGettingRelation = 1 << 3,
+    kSettingRelation = 1 << 4,
+    kAllRelations = (1 << 5) - 1,
+  };
+
+  struct Options {
+    // madvise the parts of the images each phase is about to walk
+    bool prefetch = true;
+    // ceiling in bytes for the search result caches, 0 for no limit;
+    // the caches of the least recently searched dexes are dropped first
+    size_t memory_budget = 0;
+    // records every public call with its results, not owned
+    query_log::Writer *query_log = nullptr;
+    // reads hardware counters around the constructor phases, ScanMethod
+    // and each query; costs a syscall per reading
+    bool perf_counters = false;
+    // pack the search result caches of each dex CreateFullCache completes
+    // into delta-varint streams, several times smaller than the vectors
+    bool compress_postings = true;
+    // build the tables of each dex when a call first visits it instead of
+    // in the constructor, so searches that stop early (find_first with a
+    // dex_priority) never prepare the dexes they did not reach
+    bool lazy_init = false;
+    // directory of per-dex index files (see index_file.h), nullptr for
+    // none: a dex with a file there loads its search result caches instead
+    // of scanning its code, and every full scan writes the file of its
+    // dex. Files of dexes no longer shipped are left to the caller.
+    const char *index_dir = nullptr;
+    // fd of a shared index from ExportIndex of another process with the
+    // same dexes, -1 for none: the caches of the dexes it covers are
+    // mapped from it read-only, so the processes share one copy of them.
+    // Not kept open.
+    int shared_index = -1;
+    // relations every scan of a method records, on top of the one the
+    // query scanning it needs: a string-only workload passes
+    // kStringRelation and never fills the other caches. Methods are
+    // scanned again for a relation enabled later, recording only it. A
+    // find_first query for a relation left out records nothing and stops
+    // at the first method it finds.
+    unsigned relations = kAllRelations;
+  };
+
+  DexHelper(const std::vector<std::tuple<const void *, size_t>> &dexs)
+      : DexHelper(dexs, Options()) {}
+  DexHelper(const std::vector<std::tuple<const void *, size_t>> &dexs,
+            const Options &options);
+
+  // Adds a dex loaded later, a plugin or a split installed afterwards, and
+  // returns its dex index. The class, method and field indices created so
+  // far keep their values and are extended to the new dex. Like the
+  // constructor's, the image must stay mapped until it is removed.
+  size_t AddDex(const void *image, size_t size);
+  // Retires a dex: its tables are released and queries skip it, the other
+  // dexes keep their index. Indices only found in it stay allocated but
+  // decode to nothing. The image may be unmapped afterwards.
+  void RemoveDex(size_t dex_idx);
+
+  void CreateFullCache() const { CreateFullCache(options_.relations); }
+  // completes the caches of relations, and Options::relations, in every dex
+  void CreateFullCache(unsigned relations) const;
+  // Fully scans every dex and returns a sealed memfd with their search
+  // result caches, for the app's other processes to pass as
+  // Options::shared_index. The caller owns the fd, -1 on failure.
+  int ExportIndex() const;
+
+  enum QueryKind {
+    kFindMethodUsingString,
+    kFindMethodInvoking,
+    kFindMethodInvoked,
+    kFindMethodGettingField,
+    kFindMethodSettingField,
+    kFindField,
+    kFindMethodSetUsingString,
+    kFindMethodSetInvoking,
+    kFindMethodSetInvoked,
+    kFindMethodSetGettingField,
+    kFindMethodSetSettingField,
+    kFindMethodSetOfClass,
+    kFindMethodSetMatching,
+    kQueryKindCount,
+  };
+
+  struct QueryStats {
+    size_t queries = 0;
+    // candidates walked by the scanning loops
+    size_t methods_visited = 0;
+    // candidates filtered out by the signature constraints
+    size_t methods_rejected = 0;
+    // methods whose bytecode was decoded, and their instructions
+    size_t methods_scanned = 0;
+    size_t instructions = 0;
+    // methods or results answered from the search result caches
+    size_t cache_hits = 0;
+    // new global class/method/field indices
+    size_t indices_created = 0;
+    double elapsed_ms = 0;
+    // zero unless Options::perf_counters
+    perf::Counters counters;
+
+    QueryStats &operator+=(const QueryStats &other);
+  };
+
+  // sums of the QueryStats of every query in the process, per QueryKind
+  static std::array<QueryStats, kQueryKindCount> GlobalQueryStats();
+  static void ResetGlobalQueryStats();
   std::vector<size_t> FindMethodUsingString(
       std::string_view str, bool match_prefix, size_t return_type,
       short parameter_count, std::string_view parameter_shorty,
       size_t declaring_class, const std::vector<size_t> &parameter_types,
       const std::vector<size_t> &contains_parameter_types,
-      const std::vector<size_t> &dex_priority, bool find_first) const;
+      const std::vector<size_t> &dex_priority, bool find_first,
+      QueryStats *stats = nullptr) const;
 
   std::vector<size_t> FindMethodInvoking(
       size_t method_idx, size_t return_type, short parameter_count,
       std::string_view parameter_shorty, size_t declaring_class,
       const std::vector<size_t> &parameter_types,
       const std::vector<size_t> &contains_parameter_types,
-      const std::vector<size_t> &dex_priority, bool find_first) const;
+      const std::vector<size_t> &dex_priority, bool find_first,
+      QueryStats *stats = nullptr) const;
 
   std::vector<size_t> FindMethodInvoked(
       size_t method_idx, size_t return_type, short parameter_count,
       std::string_view parameter_shorty, size_t declaring_class,
       const std::vector<size_t> &parameter_types,
       const std::vector<size_t> &contains_parameter_types,
-      const std::vector<size_t> &dex_priority, bool find_first) const;
+      const std::vector<size_t> &dex_priority, bool find_first,
+      QueryStats *stats = nullptr) const;
 
   std::vector<size_t> FindMethodGettingField(
       size_t field_idx, size_t return_type, short parameter_count,
       std::string_view parameter_shorty, size_t declaring_class,
       const std::vector<size_t> &parameter_types,
       const std::vector<size_t> &contains_parameter_types,
-      const std::vector<size_t> &dex_priority, bool find_first) const;
+      const std::vector<size_t> &dex_priority, bool find_first,
+      QueryStats *stats = nullptr) const;
 
   std::vector<size_t> FindMethodSettingField(
       size_t field_idx, size_t return_type, short parameter_count,
       std::string_view parameter_shorty, size_t declaring_class,
       const std::vector<size_t> &parameter_types,
       const std::vector<size_t> &contains_parameter_types,
-      const std::vector<size_t> &dex_priority, bool find_first) const;
+      const std::vector<size_t> &dex_priority, bool find_first,
+      QueryStats *stats = nullptr) const;
 
   std::vector<size_t> FindField(size_t type,
                                 const std::vector<size_t> &dex_priority,
-                                bool find_first) const;
+                                bool find_first,
+                                QueryStats *stats = nullptr) const;
+
+  // Methods of each dex, for combining query results with &, | and -
+  // (and not) before turning them into method indices. Sets only combine
+  // with sets of the same DexHelper.
+  struct MethodSet {
+    // dexes[dex] -> method ids
+    std::vector<RoaringSet> dexes;
+
+    MethodSet &operator&=(const MethodSet &other);
+    MethodSet &operator|=(const MethodSet &other);
+    MethodSet &operator-=(const MethodSet &other);
+    friend MethodSet operator&(MethodSet a, const MethodSet &b) {
+      return a &= b;
+    }
+    friend MethodSet operator|(MethodSet a, const MethodSet &b) {
+      return a |= b;
+    }
+    friend MethodSet operator-(MethodSet a, const MethodSet &b) {
+      return a -= b;
+    }
+    bool empty() const;
+    // a method defined in several dexes counts once per dex
+    size_t size() const;
+    // for each dex the number of its method ids followed by them, as the
+    // query log records a set without creating method indices
+    std::vector<size_t> Flatten() const;
+  };
+
+  // Set variants of the Find* queries, without filters: filter by
+  // intersecting with FindMethodSetMatching. Except for
+  // FindMethodSetInvoking they scan every dex fully once.
+  MethodSet FindMethodSetUsingString(std::string_view str, bool match_prefix,
+                                     QueryStats *stats = nullptr) const;
+  MethodSet FindMethodSetInvoking(size_t method_idx,
+                                  QueryStats *stats = nullptr) const;
+  MethodSet FindMethodSetInvoked(size_t method_idx,
+                                 QueryStats *stats = nullptr) const;
+  MethodSet FindMethodSetGettingField(size_t field_idx,
+                                      QueryStats *stats = nullptr) const;
+  MethodSet FindMethodSetSettingField(size_t field_idx,
+                                      QueryStats *stats = nullptr) const;
+  // methods declared by the class
+  MethodSet FindMethodSetOfClass(size_t class_idx,
+                                 QueryStats *stats = nullptr) const;
+  // methods passing the signature filters of the Find* queries
+  MethodSet FindMethodSetMatching(
+      size_t return_type, short parameter_count,
+      std::string_view parameter_shorty, size_t declaring_class,
+      const std::vector<size_t> &parameter_types,
+      const std::vector<size_t> &contains_parameter_types,
+      QueryStats *stats = nullptr) const;
+  // sorted method indices of the methods in set
+  std::vector<size_t> MethodIndices(const MethodSet &set) const;
 
   struct Class {
     const std::string_view name;
@@ -77,17 +257,235 @@ public:
   Field DecodeField(size_t field_idx) const;
   Method DecodeMethod(size_t method_idx) const;
 
+  struct PrefetchStats {
+    struct Phase {
+      size_t advise_calls = 0;
+      size_t advised_bytes = 0;
+      // page faults taken by the calling thread during the phase
+      size_t major_faults = 0;
+      size_t minor_faults = 0;
+    };
+    // string_data walks materializing the strings of a dex once it is
+    // searched often
+    Phase strings;
+    // class_data walk in the constructor
+    Phase class_data;
+    // code_item walks of CreateFullCache and the full scans of the queries
+    Phase code;
+  };
+  const PrefetchStats &GetPrefetchStats() const { return prefetch_stats_; }
+
+  struct PerfStats {
+    // false if Options::perf_counters is off or the counters could not be
+    // opened, every reading is zero then
+    bool available = false;
+    // string materialization, once per dex on demand
+    perf::Counters strings;
+    // constructor phases
+    perf::Counters class_data;
+    perf::Counters method_order;
+    perf::Counters id_caches;
+    // every ScanMethod call decoding bytecode, whoever made it
+    perf::Counters scan;
+    size_t scan_calls = 0;
+  };
+  const PerfStats &GetPerfStats() const { return perf_stats_; }
+
+  void SetMemoryBudget(size_t bytes);
+  // Drops the search result caches of every dex as the memory budget
+  // does, for an owner trimming an idle helper. Not recorded in the query
+  // log: it changes no result.
+  void DropCaches();
+  // bytes currently held by the search result caches
+  size_t CacheBytes() const { return cache_bytes_; }
+  // bytes of the other tables, counting those built after the constructor:
+  // the dexes prepared lazily, materialized string pools and the posting
+  // tables sized for a relation. Cheap, unlike MemoryStats().
+  size_t TableBytes() const;
+
+  struct EvictionStats {
+    // number of per-dex cache shards dropped
+    size_t evictions = 0;
+    size_t evicted_bytes = 0;
+    // methods scanned again because their dex had been evicted
+    size_t rescans = 0;
+  };
+  const EvictionStats &GetEvictionStats() const { return eviction_stats_; }
+
+  struct TableUsage {
+    const char *name;
+    size_t used = 0;
+    size_t capacity = 0;
+  };
+  struct PostingHistogram {
+    const char *name;
+    // buckets[0] counts empty lists, buckets[i] lists of [2^(i-1), 2^i)
+    std::array<size_t, 33> buckets{};
+  };
+  struct MemoryUsage {
+    // bytes per internal table, summed over all dexes
+    std::vector<TableUsage> tables;
+    // per_dex[dex] -> bytes per table of that dex
+    std::vector<std::vector<TableUsage>> per_dex;
+    // length distribution of each posting list table
+    std::vector<PostingHistogram> postings;
+    size_t used = 0;
+    size_t capacity = 0;
+  };
+  // walks every table, not meant for hot paths
+  MemoryUsage MemoryStats() const;
+
 private:
-  std::tuple<std::vector<std::vector<uint32_t>>,
-             std::vector<std::vector<uint32_t>>>
-  ConvertParameters(const std::vector<size_t> &parameter_types,
+  // collects the QueryStats of one public query
+  class QueryScope {
+  public:
+    QueryScope(const DexHelper &helper, QueryKind kind, QueryStats *out);
+    ~QueryScope();
+
+    QueryScope(const QueryScope &) = delete;
+    QueryScope &operator=(const QueryScope &) = delete;
+
+    QueryStats stats;
+
+  private:
+    const DexHelper &helper_;
+    QueryKind kind_;
+    QueryStats *out_;
+    QueryStats *outer_;
+    std::optional<slicer::Chronometer> chronometer_;
+    std::optional<perf::Scope> perf_;
+  };
+
+  // records one public call into options_.query_log, unless it is made
+  // from inside another recorded call
+  class LogScope {
+  public:
+    LogScope(const DexHelper &helper, query_log::Op op,
+             const std::vector<size_t> *out = nullptr);
+    // a set query, recording out flattened
+    LogScope(const DexHelper &helper, query_log::Op op, const MethodSet *out)
+        : LogScope(helper, op) {
+      set_ = out;
+    }
+    ~LogScope();
+
+    LogScope(const LogScope &) = delete;
+    LogScope &operator=(const LogScope &) = delete;
+
+    // records the index returned by a CreateXIndex
+    size_t Return(size_t index);
+
+    // only engaged while recording, for the caller to fill in the arguments
+    std::optional<query_log::Record> record;
+
+  private:
+    const DexHelper &helper_;
+    const std::vector<size_t> *out_;
+    const MethodSet *set_ = nullptr;
+    std::optional<slicer::Chronometer> chronometer_;
+  };
+
+  // applies the memory budget when a public entry point returns
+  struct BudgetGuard {
+    const DexHelper &helper;
+    ~BudgetGuard() { helper.EnforceMemoryBudget(); }
+  };
+
+  // a call is about to use the dex: prepares it and marks it recently used
+  void Touch(size_t dex_idx) const;
+  void EnforceMemoryBudget() const;
+  void EvictCaches(size_t dex_idx) const;
+
+  enum PostingTable {
+    kStringPostings,
+    kInvokingPostings,
+    kInvokedPostings,
+    kGettingPostings,
+    kSettingPostings,
+    kPostingTableCount,
+  };
+
+  PostingList Postings(PostingTable table, size_t dex_idx, uint32_t id) const;
+  // sizes the caches of relations in the dex, which stay empty until a
+  // scan records them
+  void AllocateCaches(size_t dex_idx, unsigned relations) const;
+  // the methods on one posting list of each dex, fully scanning them first
+  MethodSet PostingSet(PostingTable table,
+                       const std::vector<std::vector<uint32_t>> &indices,
+                       size_t index) const;
+  std::vector<std::vector<std::vector<uint32_t>>> &
+  Lists(PostingTable table) const;
+  // sizes the per-dex tables for every reader, keeping the existing ones
+  void ResizeTables();
+  // builds the preprocess tables of the dexes, phase by phase so the
+  // readahead of one dex overlaps with the walk of another
+  void PrepareDexes(const std::vector<size_t> &dex_idxs) const;
+  void Prepare(size_t dex_idx) const {
+    if (!prepared_[dex_idx])
+      PrepareDexes({dex_idx});
+  }
+  // Binds the indices created so far to their counterparts in a dex just
+  // prepared, decoding them from the dexes they were found in. With
+  // lazy_init the Create*Index calls skip the dexes not prepared yet, which
+  // bind the index here once a call visits them.
+  void BindIndices(size_t dex_idx) const;
+  // completes the caches of relations, and Options::relations, in the dex
+  void ScanDex(size_t dex_idx, unsigned relations) const;
+  // fills the search result caches of the dex from its index file, false
+  // if there is no usable file
+  bool LoadIndex(size_t dex_idx) const;
+  void SaveIndex(size_t dex_idx) const;
+  // appends the index file section of a fully scanned dex
+  void EncodeIndex(size_t dex_idx, std::vector<uint8_t> &out) const;
+  // packs the caches of the relations every method of the dex is scanned
+  // for, nothing appends to those after
+  void FreezeCaches(size_t dex_idx) const;
+  // appends the bytes of the tables of the dex, the posting lists only if
+  // postings is set
+  void AccountTables(size_t dex_idx, std::vector<TableUsage> &tables,
+                     bool postings) const;
+  // updates table_bytes_ after tables of the dex were built or released
+  void MeasureTables(size_t dex_idx) const;
+
+  enum Region { kStringData, kClassData, kCodeItems, kRegionCount };
+
+  void Advise(size_t dex_idx, Region region, int advice,
+              PrefetchStats::Phase &phase) const;
+  void PrefetchCode(size_t dex_idx) const;
+
+  // the ids in the dex of the parameter type classes, once Touch bound the
+  // indices to it
+  std::tuple<std::vector<uint32_t>, std::vector<uint32_t>>
+  ConvertParameters(size_t dex_idx, const std::vector<size_t> &parameter_types,
                     const std::vector<size_t> &contains_parameter_types) const;
 
   std::vector<size_t> GetPriority(const std::vector<size_t> &priority) const;
 
-  bool ScanMethod(size_t dex_idx, uint32_t method_id,
+  // Records relations, and Options::relations, of the method unless it
+  // was scanned for them. True if it loads a string in [str_lower,
+  // str_upper) while recording kStringRelation.
+  bool ScanMethod(size_t dex_idx, uint32_t method_id, unsigned relations,
                   size_t str_lower = size_t(-1),
                   size_t str_upper = size_t(-1)) const;
+  // The method of list, or first, a scan in code offset order meets
+  // first: find_first returns it, as a cold scan stops there.
+  uint32_t FirstInCodeOrder(size_t dex_idx, PostingList list,
+                            uint32_t first = dex::kNoIndex) const;
+  // Whether the method's code refers to an id in [lower, upper) under
+  // relation, stopping at the first reference and recording nothing:
+  // find_first queries for a relation outside Options::relations use it.
+  bool Probe(size_t dex_idx, uint32_t method_id, Relation relation,
+             uint32_t lower, uint32_t upper) const;
+
+  // string of the pool, without materializing it
+  std::string_view String(size_t dex_idx, uint32_t string_id) const;
+  std::string_view TypeName(size_t dex_idx, uint32_t type_id) const;
+  // the search structure of the dex, nullptr until it was searched
+  // kStringIndexSearches times: then its strings are materialized once
+  const StringIndex *SearchIndex(size_t dex_idx) const;
+  // binary search over the string pool, reading strings in place
+  template <class Before>
+  uint32_t StringPartition(size_t dex_idx, Before before) const;
 
   std::tuple<uint32_t, uint32_t>
   FindPrefixStringId(size_t dex_idx, std::string_view to_find) const;
@@ -106,7 +504,23 @@ private:
   size_t CreateClassIndex(size_t dex_idx, uint32_t class_id) const;
   size_t CreateFieldIndex(size_t dex_idx, uint32_t field_id) const;
 
+  // id of a decoded class, method or field in the dex, kNoIndex if the
+  // dex does not have it
+  uint32_t FindClassId(size_t dex_idx, std::string_view class_name) const;
+  uint32_t FindMethodId(size_t dex_idx, const Method &method) const;
+  uint32_t FindFieldId(size_t dex_idx, const Field &field) const;
+
   std::vector<dex::Reader> readers_;
+  Options options_;
+  // removed[dex] -> retired by RemoveDex, its tables are empty
+  std::vector<bool> removed_;
+
+  // regions[dex][region] -> (offset, size) in the image
+  mutable std::vector<std::array<std::tuple<uint32_t, uint32_t>, kRegionCount>>
+      regions_;
+  mutable std::vector<bool> code_prefetched_;
+  mutable PrefetchStats prefetch_stats_;
+  mutable PerfStats perf_stats_;
 
   // for interface
   // indices[method_index][dex] -> id
@@ -119,24 +533,36 @@ private:
   mutable std::vector<std::vector<size_t>> rev_field_indices_;
 
   // for preprocess
-  // strings[dex][str_id] -> str
-  std::vector<std::vector<std::string_view>> strings_;
+  // the tables below of the dex are built, see Options::lazy_init
+  mutable std::vector<bool> prepared_;
+  // strings[dex][str_id] -> str, empty until SearchIndex materializes it
+  mutable std::vector<std::vector<std::string_view>> strings_;
+  // string_index[dex] -> search structure over strings[dex]
+  mutable std::vector<StringIndex> string_index_;
+  // searches before the index of a dex is built: most apps only ever look
+  // up a handful of names in most of their dexes
+  static constexpr uint32_t kStringIndexSearches = 64;
+  mutable std::vector<uint32_t> string_searches_;
   // method_codes[dex][method_id] -> code
-  std::vector<std::vector<const dex::Code *>> method_codes_;
-  std::vector<std::vector<const dex::TypeList *>> method_params_;
+  mutable std::vector<std::vector<const dex::Code *>> method_codes_;
+  mutable std::vector<std::vector<const dex::TypeList *>> method_params_;
+  // method_order[dex] -> method_ids with code, sorted by code offset
+  mutable std::vector<std::vector<uint32_t>> method_order_;
 
   // for cache
   // type_cache[dex][str_id] -> type_id
-  std::vector<std::vector<uint32_t>> type_cache_;
+  mutable std::vector<std::vector<uint32_t>> type_cache_;
   // field_cache[dex][type_id][str_id] -> method_ids
-  std::vector<std::vector<std::unordered_map<uint32_t, std::vector<uint32_t>>>>
+  mutable std::vector<
+      std::vector<std::unordered_map<uint32_t, std::vector<uint32_t>>>>
       method_cache_;
   // field_cache[dex][type_id][str_id] -> field_id
-  std::vector<std::vector<std::unordered_map<uint32_t, uint32_t>>> field_cache_;
+  mutable std::vector<std::vector<std::unordered_map<uint32_t, uint32_t>>>
+      field_cache_;
   // class_cache[dex][type_id] -> class_id
-  std::vector<std::vector<uint32_t>> class_cache_;
+  mutable std::vector<std::vector<uint32_t>> class_cache_;
 
-  // search result cache
+  // search result cache, every list sorted and unique
   // string_cache[dex][str_id] -> method_ids
   mutable std::vector<std::vector<std::vector<uint32_t>>> string_cache_;
   // invoking_cache[dex][method_id] -> method_ids
@@ -148,19 +574,37 @@ private:
   mutable std::vector<std::vector<std::vector<uint32_t>>> setting_cache_;
   mutable std::vector<std::vector<std::vector<uint32_t>>> declaring_cache_;
   // for method search
-  mutable std::vector<std::vector<bool>> searched_methods_;
-
-  constexpr static uint8_t opcode_len[] = {
-      1, 1, 2, 3, 1, 2, 3, 1, 2, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 3, 2, 2, 3,
-      5, 2, 2, 3, 2, 1, 1, 2, 2, 1, 2, 2, 3, 3, 3, 1, 1, 2, 3, 3, 3, 2, 2, 2,
-      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2,
-      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 1, 3, 3, 3, 3,
-      3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-      2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-      1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
-      2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-      1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 4, 3, 3, 2, 2};
-  static_assert(sizeof(opcode_len) == 256);
+  // searched_methods[dex][method_id] -> Relation bits it was scanned for
+  mutable std::vector<std::vector<uint8_t>> searched_methods_;
+
+  // frozen[dex][table] -> the search result cache once packed, the
+  // vectors are released then
+  mutable std::vector<std::array<FrozenPostings, kPostingTableCount>> frozen_;
+  // dex_scanned[dex] -> Relation bits every method of the dex is scanned for
+  mutable std::vector<uint8_t> dex_scanned_;
+  // index_files[dex] -> its mapped index file once loaded
+  mutable std::vector<index_file::Mapping> index_files_;
+  // mapping of Options::shared_index
+  index_file::Mapping shared_index_;
+
+  // for memory budget
+  // dex_cache_bytes[dex] -> bytes held by the search result caches
+  mutable std::vector<size_t> dex_cache_bytes_;
+  mutable size_t cache_bytes_ = 0;
+  // dex_table_bytes[dex] -> bytes of its tables besides the posting lists,
+  // as of the last MeasureTables
+  mutable std::vector<size_t> dex_table_bytes_;
+  mutable size_t table_bytes_ = 0;
+  // last_used[dex] -> clock_ of the last query visiting the dex
+  mutable std::vector<uint64_t> last_used_;
+  mutable uint64_t clock_ = 0;
+  mutable std::vector<std::vector<bool>> ever_scanned_;
+  mutable EvictionStats eviction_stats_;
+
+  // stats of the query in progress, if any
+  mutable QueryStats *query_stats_ = nullptr;
+  // a call is being recorded into the query log
+  mutable bool logging_ = false;
+  // tags the records of this helper in options_.query_log
+  size_t log_session_ = 0;
 };
@@ -0,0 +1,89 @@
+#include <algorithm>
+
+#include "dex_helper_pool.h"
+
+void DexHelperPool::Add(std::string name,
+                        std::vector<std::tuple<const void *, size_t>> dexs) {
+  Remove(name);
+  apps_.push_back(
+      {.name = std::move(name), .dexs = std::move(dexs), .helper = nullptr});
+}
+
+void DexHelperPool::Remove(std::string_view name) {
+  std::erase_if(apps_, [name](const App &app) { return app.name == name; });
+}
+
+DexHelperPool::App *DexHelperPool::Find(std::string_view name) {
+  for (auto &app : apps_) {
+    if (app.name == name)
+      return &app;
+  }
+  return nullptr;
+}
+
+DexHelper *DexHelperPool::Acquire(std::string_view name, bool *reloaded) {
+  auto *app = Find(name);
+  if (!app)
+    return nullptr;
+  if (reloaded)
+    *reloaded = !app->handed_out;
+  if (!app->helper) {
+    app->helper = std::make_unique<DexHelper>(app->dexs, options_.helper);
+    ++stats_.loads;
+  }
+  app->handed_out = true;
+  app->last_used = ++clock_;
+  Trim(app);
+  return app->helper.get();
+}
+
+size_t DexHelperPool::Bytes(const App &app) {
+  return app.helper ? app.helper->TableBytes() + app.helper->CacheBytes() : 0;
+}
+
+size_t DexHelperPool::Bytes() const {
+  size_t bytes = 0;
+  for (auto &app : apps_)
+    bytes += Bytes(app);
+  return bytes;
+}
+
+size_t DexHelperPool::LoadedCount() const {
+  return std::count_if(apps_.begin(), apps_.end(),
+                       [](const App &app) { return app.helper != nullptr; });
+}
+
+void DexHelperPool::Trim(const App *keep) {
+  if (options_.memory_budget == 0)
+    return;
+  auto bytes = Bytes();
+  if (bytes <= options_.memory_budget)
+    return;
+  std::vector<App *> lru;
+  for (auto &app : apps_) {
+    if (app.helper && &app != keep)
+      lru.emplace_back(&app);
+  }
+  std::sort(lru.begin(), lru.end(), [](const App *a, const App *b) {
+    return a->last_used < b->last_used;
+  });
+  // caches are rebuilt query by query, a helper only as a whole
+  for (auto *app : lru) {
+    if (bytes <= options_.memory_budget)
+      return;
+    if (app->helper->CacheBytes() == 0)
+      continue;
+    auto app_bytes = Bytes(*app);
+    app->helper->DropCaches();
+    bytes -= app_bytes - Bytes(*app);
+    ++stats_.cache_drops;
+  }
+  for (auto *app : lru) {
+    if (bytes <= options_.memory_budget)
+      return;
+    bytes -= Bytes(*app);
+    app->helper.reset();
+    app->handed_out = false;
+    ++stats_.evictions;
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "dex_helper.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// Keeps the DexHelpers of many apps in one process under a single memory
+// budget.
+//
+// Helpers are built when an app is first acquired. While the pool is over
+// budget, the least recently acquired helpers first drop their search
+// result caches, then are destroyed whole; the next Acquire of such an app
+// builds its helper again. With Options::helper.index_dir set, the dexes a
+// helper had fully scanned then load their caches from the index files
+// instead of being scanned again.
+//
+// Not thread safe, like DexHelper.
+class DexHelperPool {
+public:
+  struct Options {
+    // ceiling in bytes for the helpers together, 0 for no limit
+    size_t memory_budget = 0;
+    // options every helper is built with
+    DexHelper::Options helper;
+  };
+
+  struct Stats {
+    // helpers built, the first time or after an eviction
+    size_t loads = 0;
+    // helpers destroyed to meet the budget
+    size_t evictions = 0;
+    // helpers whose caches were dropped to meet the budget
+    size_t cache_drops = 0;
+  };
+
+  explicit DexHelperPool(const Options &options) : options_(options) {}
+
+  // Registers an app under name, replacing an app of the same name. The
+  // images must stay mapped until it is removed: evicted helpers are
+  // rebuilt from them.
+  void Add(std::string name,
+           std::vector<std::tuple<const void *, size_t>> dexs);
+  void Remove(std::string_view name);
+
+  // The helper of the app, built if it is not loaded, nullptr for an
+  // unknown name. Valid until the next call to the pool. reloaded tells
+  // whether it is not the helper the previous Acquire of the app returned:
+  // the class, method and field indices from that one must be created
+  // again.
+  DexHelper *Acquire(std::string_view name, bool *reloaded = nullptr);
+  // applies the budget to what the queries since the last Acquire cached
+  void Trim() { Trim(nullptr); }
+
+  // accounted bytes of the loaded helpers, their TableBytes and CacheBytes
+  size_t Bytes() const;
+  size_t LoadedCount() const;
+  const Stats &GetStats() const { return stats_; }
+
+private:
+  struct App {
+    std::string name;
+    std::vector<std::tuple<const void *, size_t>> dexs;
+    std::unique_ptr<DexHelper> helper;
+    // Acquire returned the current helper already
+    bool handed_out = false;
+    // clock_ of the last Acquire of the app
+    uint64_t last_used = 0;
+  };
+
+  App *Find(std::string_view name);
+  static size_t Bytes(const App &app);
+  // drops caches, then helpers, of the apps other than keep
+  void Trim(const App *keep);
+
+  Options options_;
+  std::vector<App> apps_;
+  uint64_t clock_ = 0;
+  Stats stats_;
+};
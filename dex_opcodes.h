@@ -0,0 +1,127 @@
+#pragma once
+
+#include "slicer/dex_bytecode.h"
+#include "slicer/dex_format.h"
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "dex_helper.h"
+
+// The opcode table the bytecode scans of DexHelper decode with, derived
+// from the instruction list of slicer.
+namespace dex_opcodes {
+
+// what DexHelper::ScanMethod records for an opcode
+struct OpcodeInfo {
+  // in code units, without the payload of a nop
+  uint8_t width;
+  // DexHelper::Relation bits the referenced index is recorded under
+  uint8_t relations;
+  // code unit holding that index
+  uint8_t operand;
+  // the index takes two code units
+  bool wide;
+};
+
+// Dalvik format names start with the width: a k22c is 2 code units
+constexpr OpcodeInfo Classify(std::string_view format,
+                              dex::InstructionIndexType index,
+                              dex::OpcodeFlags flags, bool load, bool store) {
+  OpcodeInfo info{.width = uint8_t(format[1] - '0'),
+                  .relations = 0,
+                  .operand = 0,
+                  .wide = false};
+  switch (index) {
+  case dex::kIndexStringRef:
+    info.relations = DexHelper::kStringRelation;
+    break;
+  case dex::kIndexFieldRef:
+    if (load)
+      info.relations = DexHelper::kGettingRelation;
+    else if (store)
+      info.relations = DexHelper::kSettingRelation;
+    break;
+  case dex::kIndexMethodRef:
+    // not the quickened or polymorphic invokes
+    if (flags & dex::kInvoke)
+      info.relations =
+          DexHelper::kInvokingRelation | DexHelper::kInvokedRelation;
+    break;
+  default:
+    break;
+  }
+  // 21c, 22c, 31c, 35c and 3rc all follow the opcode unit with the index
+  info.operand = 1;
+  info.wide = format == "k31c";
+  return info;
+}
+
+constexpr std::array<OpcodeInfo, dex::kNumPackedOpcodes> MakeOpcodeTable() {
+  using namespace dex;
+  // the extended flags of the instruction list, which slicer leaves out
+  enum : uint32_t {
+    kAdd = 1 << 0,
+    kSubtract = 1 << 1,
+    kMultiply = 1 << 2,
+    kDivide = 1 << 3,
+    kRemainder = 1 << 4,
+    kAnd = 1 << 5,
+    kOr = 1 << 6,
+    kXor = 1 << 7,
+    kShl = 1 << 8,
+    kShr = 1 << 9,
+    kUshr = 1 << 10,
+    kCast = 1 << 11,
+    kStore = 1 << 12,
+    kLoad = 1 << 13,
+    kClobber = 1 << 14,
+    kRegCFieldOrConstant = 1 << 15,
+    kRegBFieldOrConstant = 1 << 16,
+  };
+  std::array<OpcodeInfo, kNumPackedOpcodes> table{};
+#define OPCODE_INFO(opcode, cname, name, format, index, flags, extended, v)   \
+  table[opcode] = Classify(#format, index, flags, ((extended) & kLoad) != 0,  \
+                           ((extended) & kStore) != 0);
+#include "slicer/dex_instruction_list.h"
+  DEX_INSTRUCTION_LIST(OPCODE_INFO)
+#undef DEX_INSTRUCTION_LIST
+#undef OPCODE_INFO
+  return table;
+}
+
+inline constexpr auto kOpcodes = MakeOpcodeTable();
+static_assert(kOpcodes[dex::OP_CONST_STRING_JUMBO].wide &&
+              kOpcodes[dex::OP_CONST_WIDE].width == 5 &&
+              kOpcodes[dex::OP_SGET_OBJECT].relations ==
+                  DexHelper::kGettingRelation &&
+              kOpcodes[dex::OP_IPUT_QUICK].relations == 0 &&
+              kOpcodes[dex::OP_INVOKE_INTERFACE_RANGE].relations != 0);
+
+// the instruction after inst, stepping over the payload a nop introduces
+inline const dex::u2 *NextInstruction(const dex::u2 *inst,
+                                      const OpcodeInfo &info) {
+  if ((*inst & 0xff) == 0x00) {
+    if (*inst == 0x0100) {
+      // packed-switch-payload
+      inst += inst[1] * 2 + 3;
+    } else if (*inst == 0x0200) {
+      // sparse-switch-payload
+      inst += inst[1] * 4 + 1;
+    } else if (*inst == 0x0300) {
+      // fill-array-data-payload
+      inst +=
+          (*reinterpret_cast<const dex::u4 *>(&inst[2]) * inst[1] + 1) / 2 + 3;
+    }
+  }
+  return inst + info.width;
+}
+
+// the index an instruction with relations in its OpcodeInfo refers to
+inline uint32_t Operand(const dex::u2 *inst, const OpcodeInfo &info) {
+  return info.wide ? *reinterpret_cast<const dex::u4 *>(&inst[info.operand])
+                   : inst[info.operand];
+}
+
+} // namespace dex_opcodes
@@ -0,0 +1,216 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "index_file.h"
+
+namespace index_file {
+
+namespace {
+constexpr char kMagic[8] = {'D', 'X', 'I', 'D', 'X', '0', '0', '2'};
+// magic, signature, section size
+constexpr size_t kSectionHeader = sizeof(kMagic) + dex::kSHA1DigestLen + 4;
+constexpr int kSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+
+void Append(std::vector<uint8_t> &out, const void *data, size_t size) {
+  auto *bytes = static_cast<const uint8_t *>(data);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+void Pad(std::vector<uint8_t> &out) { out.resize((out.size() + 3) & ~3); }
+
+class Decoder {
+public:
+  Decoder(const uint8_t *begin, const uint8_t *end) : ptr_(begin), end_(end) {}
+
+  // the next size bytes, nullptr if there are fewer left
+  const uint8_t *Bytes(size_t size) {
+    if (size > size_t(end_ - ptr_))
+      return nullptr;
+    auto *bytes = ptr_;
+    ptr_ += size;
+    return bytes;
+  }
+  bool Uint(uint32_t &value) {
+    auto *bytes = Bytes(sizeof(value));
+    if (bytes)
+      memcpy(&value, bytes, sizeof(value));
+    return bytes;
+  }
+  // skips the padding up to a multiple of 4
+  void Align() { Bytes(-uintptr_t(ptr_) & 3); }
+  bool done() const { return ptr_ == end_; }
+
+private:
+  const uint8_t *ptr_;
+  const uint8_t *end_;
+};
+
+bool Tables(Decoder &decoder, const std::vector<Table> &shapes,
+            std::vector<FrozenPostings> &tables) {
+  tables.resize(shapes.size());
+  for (size_t i = 0; i < shapes.size(); ++i) {
+    uint32_t lists, bytes;
+    if (!decoder.Uint(lists) || !decoder.Uint(bytes) ||
+        lists != shapes[i].lists)
+      return false;
+    size_t offsets_size = (size_t(lists) + 1) * sizeof(uint32_t);
+    auto *offsets = decoder.Bytes(offsets_size);
+    auto *data = decoder.Bytes(bytes);
+    if (!offsets || !data)
+      return false;
+    decoder.Align();
+    // sections are 4-aligned within page-aligned mappings
+    if (!tables[i].View({reinterpret_cast<const uint32_t *>(offsets),
+                         size_t(lists) + 1},
+                        {data, bytes}, lists, shapes[i].id_limit))
+      return false;
+  }
+  return decoder.done();
+}
+} // namespace
+
+Mapping::Mapping(int fd) {
+  struct stat s {};
+  if (fstat(fd, &s) != 0 || s.st_size == 0)
+    return;
+  void *data = mmap(nullptr, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+    return;
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = s.st_size;
+}
+
+Mapping::~Mapping() {
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+Mapping::Mapping(Mapping &&other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+Mapping &Mapping::operator=(Mapping &&other) noexcept {
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  return *this;
+}
+
+bool Mapping::Find(const dex::Header &header, const std::vector<Table> &shapes,
+                   std::vector<FrozenPostings> &tables) const {
+  Decoder decoder(data_, data_ + size_);
+  while (auto *section = decoder.Bytes(kSectionHeader)) {
+    uint32_t size;
+    memcpy(&size, section + kSectionHeader - sizeof(size), sizeof(size));
+    if (memcmp(section, kMagic, sizeof(kMagic)) != 0 ||
+        size < kSectionHeader || size % 4 != 0)
+      return false;
+    auto *body = decoder.Bytes(size - kSectionHeader);
+    if (!body)
+      return false;
+    auto *signature = section + sizeof(kMagic);
+    if (memcmp(signature, header.signature, dex::kSHA1DigestLen) != 0)
+      continue;
+    Decoder tables_decoder(body, section + size);
+    if (Tables(tables_decoder, shapes, tables))
+      return true;
+    tables.clear();
+    return false;
+  }
+  return false;
+}
+
+void Encode(std::vector<uint8_t> &out, const dex::Header &header,
+            const std::vector<const FrozenPostings *> &tables) {
+  Pad(out);
+  auto start = out.size();
+  Append(out, kMagic, sizeof(kMagic));
+  Append(out, header.signature, sizeof(header.signature));
+  // patched once the section is complete
+  uint32_t size = 0;
+  Append(out, &size, sizeof(size));
+  for (auto *table : tables) {
+    auto offsets = table->offsets();
+    auto data = table->data();
+    uint32_t counts[] = {uint32_t(table->size()), uint32_t(data.size())};
+    Append(out, counts, sizeof(counts));
+    Append(out, offsets.data(), offsets.size_bytes());
+    Append(out, data.data(), data.size());
+    Pad(out);
+  }
+  size = out.size() - start;
+  memcpy(&out[start + kSectionHeader - sizeof(size)], &size, sizeof(size));
+}
+
+std::string Path(const char *dir, const dex::Header &header) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string path = dir;
+  path += '/';
+  for (auto byte : header.signature) {
+    path += kHex[byte >> 4];
+    path += kHex[byte & 0xf];
+  }
+  return path + ".idx";
+}
+
+bool Write(const std::string &path, const std::vector<uint8_t> &sections) {
+  // unique per writer: processes of the same app may write the same file
+  auto temp = path + ".XXXXXX";
+  int fd = mkostemp(temp.data(), O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  size_t written = 0;
+  while (written < sections.size()) {
+    auto n = write(fd, sections.data() + written, sections.size() - written);
+    if (n <= 0)
+      break;
+    written += n;
+  }
+  // mkostemp creates it private to the user
+  bool ok = written == sections.size() && fchmod(fd, 0644) == 0;
+  ok = close(fd) == 0 && ok;
+  if (ok && rename(temp.c_str(), path.c_str()) == 0)
+    return true;
+  unlink(temp.c_str());
+  return false;
+}
+
+Mapping Open(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return {};
+  Mapping mapping(fd);
+  close(fd);
+  return mapping;
+}
+
+int Share(const std::vector<uint8_t> &sections) {
+  int fd = memfd_create("dexhelper-index", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return -1;
+  size_t written = 0;
+  while (written < sections.size()) {
+    auto n = write(fd, sections.data() + written, sections.size() - written);
+    if (n <= 0)
+      break;
+    written += n;
+  }
+  if (written == sections.size() && fcntl(fd, F_ADD_SEALS, kSeals) == 0)
+    return fd;
+  close(fd);
+  return -1;
+}
+
+Mapping MapShared(int fd) {
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals == -1 || (seals & kSeals) != kSeals)
+    return {};
+  return Mapping(fd);
+}
+
+} // namespace index_file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "posting_list.h"
+#include "slicer/dex_format.h"
+#include <string>
+#include <vector>
+
+// Persisted search result caches of fully scanned dexes, mapped read-only
+// so that the processes using them share a single copy in memory.
+//
+// The caches of a dex make up a section keyed by the SHA-1 signature in
+// the dex header. A per-dex index file holds one section and is named
+// after the signature, so after an app update the files of the dexes that
+// did not change still apply. A shared index is a sealed memfd holding
+// the sections of every dex of a process, passed to the other processes
+// of the app.
+//
+// A section is a magic, the signature, its size and the packed posting
+// tables, each as its list count, its byte count, the list offsets and the
+// bytes padded to 4. Integers are in native byte order: the files are a
+// cache of the device they were written on.
+namespace index_file {
+
+// shape a table read back must have
+struct Table {
+  size_t lists;
+  // every entry is below it
+  uint32_t id_limit;
+};
+
+// A read-only shared mapping of an index file or a shared index.
+class Mapping {
+public:
+  Mapping() = default;
+  ~Mapping();
+  Mapping(Mapping &&other) noexcept;
+  Mapping &operator=(Mapping &&other) noexcept;
+
+  bool empty() const { return data_ == nullptr; }
+  // Views the tables of the dex into tables, valid while the mapping is.
+  // False if no section is for the dex or it does not match shapes.
+  bool Find(const dex::Header &header, const std::vector<Table> &shapes,
+            std::vector<FrozenPostings> &tables) const;
+
+private:
+  friend Mapping Open(const std::string &path);
+  friend Mapping MapShared(int fd);
+  // maps the whole of fd, stays empty if it cannot
+  explicit Mapping(int fd);
+
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// appends the section of a dex to out
+void Encode(std::vector<uint8_t> &out, const dex::Header &header,
+            const std::vector<const FrozenPostings *> &tables);
+
+// <dir>/<signature in hex>.idx
+std::string Path(const char *dir, const dex::Header &header);
+// Writes through a temporary file renamed into place, so a mapping never
+// sees the file change. False if it could not be written.
+bool Write(const std::string &path, const std::vector<uint8_t> &sections);
+// empty if the file is missing
+Mapping Open(const std::string &path);
+
+// A memfd holding sections, sealed so that no process can change it once
+// others validated and mapped it. -1 if it could not be created.
+int Share(const std::vector<uint8_t> &sections);
+// empty unless fd is a memfd sealed by Share
+Mapping MapShared(int fd);
+
+} // namespace index_file
@@ -1,8 +1,10 @@
+#include "apk_loader.h"
 #include "dex_helper.h"
 #include <cstdint>
 #include <endian.h>
 #include <fcntl.h>
 #include <iostream>
+#include <memory>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -28,7 +30,12 @@ std::ostream &operator<<(std::ostream &out, const DexHelper::Method &method) {
 
 int main(int argc, char *argv[]) {
   std::vector<std::tuple<const void *, size_t>> dexs;
-  for (int i = 1; i <= 100; ++i) {
+  std::unique_ptr<ApkLoader> apk;
+  if (argc > 1 && std::string_view(argv[1]).ends_with(".apk")) {
+    apk = std::make_unique<ApkLoader>(argv[1]);
+    dexs = apk->Dexes();
+  }
+  for (int i = 1; i <= 100 && !apk; ++i) {
     std::string path = "dexs/classes" +
                        (i == 1 ? std::string("") : std::to_string(i)) + ".dex";
     int raw_dex = open(path.data(), O_RDONLY);
@@ -42,7 +49,6 @@ int main(int argc, char *argv[]) {
     dexs.emplace_back(out, s.st_size);
   }
 
-  std::string_view to_find = argv[2];
   DexHelper helper(dexs);
 
   auto class_idx = helper.CreateClassIndex("Ljava/lang/Object;");
@@ -0,0 +1,111 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf_counters.h"
+
+namespace perf {
+
+namespace {
+constexpr uint64_t kEvents[] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+constexpr size_t kEventCount = sizeof(kEvents) / sizeof(*kEvents);
+
+int Open(uint64_t config, int group_fd) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.disabled = group_fd == -1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd,
+                 PERF_FLAG_FD_CLOEXEC);
+}
+
+// one counter group per thread, opened on first use
+class Group {
+public:
+  Group() {
+    leader_ = Open(kEvents[0], -1);
+    if (leader_ == -1)
+      return;
+    slots_[0] = 0;
+    size_t opened = 1;
+    for (size_t i = 1; i < kEventCount; ++i) {
+      // an event the PMU lacks just stays zero
+      fds_[i] = Open(kEvents[i], leader_);
+      if (fds_[i] != -1)
+        slots_[i] = opened++;
+    }
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  ~Group() {
+    for (size_t i = 1; i < kEventCount; ++i) {
+      if (fds_[i] != -1)
+        close(fds_[i]);
+    }
+    if (leader_ != -1)
+      close(leader_);
+  }
+
+  bool ok() const { return leader_ != -1; }
+
+  bool Read(Counters &counters) const {
+    // PERF_FORMAT_GROUP: the number of events, then their values in the
+    // order they were opened
+    uint64_t values[kEventCount + 1];
+    if (leader_ == -1 || read(leader_, values, sizeof(values)) <= 0)
+      return false;
+    uint64_t *fields[] = {&counters.cycles, &counters.instructions,
+                          &counters.branch_misses, &counters.cache_misses};
+    for (size_t i = 0; i < kEventCount; ++i) {
+      if (slots_[i] != size_t(-1))
+        *fields[i] = values[1 + slots_[i]];
+    }
+    return true;
+  }
+
+private:
+  int leader_ = -1;
+  int fds_[kEventCount] = {-1, -1, -1, -1};
+  size_t slots_[kEventCount] = {size_t(-1), size_t(-1), size_t(-1),
+                                size_t(-1)};
+};
+
+Group &ThreadGroup() {
+  thread_local Group group;
+  return group;
+}
+} // namespace
+
+Counters &Counters::operator+=(const Counters &other) {
+  cycles += other.cycles;
+  instructions += other.instructions;
+  branch_misses += other.branch_misses;
+  cache_misses += other.cache_misses;
+  return *this;
+}
+
+bool Available() { return ThreadGroup().ok(); }
+
+Scope::Scope(Counters &out, bool enabled)
+    : out_(out), active_(enabled && ThreadGroup().Read(begin_)) {}
+
+Scope::~Scope() {
+  Counters end;
+  if (!active_ || !ThreadGroup().Read(end))
+    return;
+  out_.cycles += end.cycles - begin_.cycles;
+  out_.instructions += end.instructions - begin_.instructions;
+  out_.branch_misses += end.branch_misses - begin_.branch_misses;
+  out_.cache_misses += end.cache_misses - begin_.cache_misses;
+}
+
+} // namespace perf
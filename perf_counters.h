@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+// Hardware performance counters of the calling thread, read through Linux
+// perf_event_open. Counting is user space only so it works under the
+// default perf_event_paranoid level; where the counters cannot be opened
+// (no PMU, seccomp, older kernels) every reading stays zero.
+//
+// Each reading is a read(2) on the counter group, so scopes around short
+// code paths add noticeable overhead: this is an instrumentation mode.
+namespace perf {
+
+struct Counters {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t branch_misses = 0;
+  // last level cache misses
+  uint64_t cache_misses = 0;
+
+  Counters &operator+=(const Counters &other);
+};
+
+// whether the counters of the calling thread could be opened
+bool Available();
+
+// Adds the counts of the calling thread during its lifetime to out, does
+// nothing unless enabled.
+class Scope {
+public:
+  explicit Scope(Counters &out, bool enabled = true);
+  ~Scope();
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  Counters &out_;
+  Counters begin_;
+  bool active_;
+};
+
+} // namespace perf
@@ -0,0 +1,72 @@
+#include "posting_list.h"
+
+size_t PostingList::size() const {
+  if (list_)
+    return list_->size();
+  size_t count = 0;
+  for (auto p = begin_; p != end_; ++p) {
+    // one entry ends at each byte without the continuation bit
+    count += !(*p & 0x80);
+  }
+  return count;
+}
+
+FrozenPostings::FrozenPostings(
+    const std::vector<std::vector<uint32_t>> &lists) {
+  size_t entries = 0;
+  for (auto &list : lists)
+    entries += list.size();
+  auto &offsets = owned_offsets_;
+  auto &data = owned_data_;
+  offsets.reserve(lists.size() + 1);
+  data.reserve(entries * 2);
+  for (auto &list : lists) {
+    offsets.emplace_back(data.size());
+    uint32_t prev = 0;
+    for (auto value : list) {
+      int32_t delta = int32_t(value - prev);
+      uint32_t zigzag = (uint32_t(delta) << 1) ^ uint32_t(delta >> 31);
+      do {
+        uint8_t byte = zigzag & 0x7f;
+        zigzag >>= 7;
+        data.emplace_back(byte | (zigzag ? 0x80 : 0));
+      } while (zigzag);
+      prev = value;
+    }
+  }
+  offsets.emplace_back(data.size());
+  data.shrink_to_fit();
+  offsets_ = offsets;
+  data_ = data;
+}
+
+bool FrozenPostings::View(std::span<const uint32_t> offsets,
+                          std::span<const uint8_t> data, size_t lists,
+                          uint32_t id_limit) {
+  *this = {};
+  if (offsets.size() != lists + 1 || offsets.back() != data.size())
+    return false;
+  size_t run = 0;
+  for (auto byte : data) {
+    // a varint of a uint32_t takes at most five bytes
+    run = byte & 0x80 ? run + 1 : 0;
+    if (run > 4)
+      return false;
+  }
+  for (size_t i = 0; i < lists; ++i) {
+    auto begin = offsets[i], end = offsets[i + 1];
+    if (begin > end || end > data.size())
+      return false;
+    // a list must not end inside a varint, or decoding it runs past its end
+    if (begin != end && data[end - 1] & 0x80)
+      return false;
+    PostingList list(data.data() + begin, data.data() + end);
+    for (auto id : list) {
+      if (id >= id_limit)
+        return false;
+    }
+  }
+  offsets_ = offsets;
+  data_ = data;
+  return true;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <vector>
+
+// Read-only view of one posting list of the search result caches: either a
+// growing std::vector (seeing later appends) or a list inside a
+// FrozenPostings stream.
+class PostingList {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = uint32_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const uint32_t *;
+    using reference = uint32_t;
+
+    uint32_t operator*() const { return value_; }
+    iterator &operator++() {
+      ptr_ = next_;
+      Load();
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return ptr_ == other.ptr_; }
+    bool operator!=(const iterator &other) const { return ptr_ != other.ptr_; }
+
+  private:
+    friend class PostingList;
+    iterator(const uint8_t *ptr, const uint8_t *end, bool packed)
+        : ptr_(ptr), end_(end), packed_(packed) {
+      Load();
+    }
+    void Load();
+
+    const uint8_t *ptr_;
+    const uint8_t *end_;
+    const uint8_t *next_ = nullptr;
+    uint32_t value_ = 0;
+    bool packed_;
+  };
+
+  // an empty list
+  PostingList() = default;
+  explicit PostingList(const std::vector<uint32_t> &list) : list_(&list) {}
+  PostingList(const uint8_t *begin, const uint8_t *end)
+      : begin_(begin), end_(end) {}
+
+  iterator begin() const {
+    if (list_)
+      return {Bytes(list_->data()), Bytes(list_->data() + list_->size()),
+              false};
+    return {begin_, end_, true};
+  }
+  iterator end() const {
+    if (list_) {
+      auto *end = Bytes(list_->data() + list_->size());
+      return {end, end, false};
+    }
+    return {end_, end_, true};
+  }
+  bool empty() const { return list_ ? list_->empty() : begin_ == end_; }
+  uint32_t front() const { return *begin(); }
+  // walks a frozen list, not meant for hot paths
+  size_t size() const;
+
+private:
+  static const uint8_t *Bytes(const uint32_t *p) {
+    return reinterpret_cast<const uint8_t *>(p);
+  }
+
+  const std::vector<uint32_t> *list_ = nullptr;
+  const uint8_t *begin_ = nullptr;
+  const uint8_t *end_ = nullptr;
+};
+
+// A table of posting lists packed into one byte stream: each entry is the
+// zigzag encoded difference to the previous one as a varint, so the order
+// of the lists is kept and sorted lists of nearby ids take a byte per entry.
+// The stream is owned, or a view of a read-only mapping that other
+// processes may share (see index_file.h).
+class FrozenPostings {
+public:
+  FrozenPostings() = default;
+  explicit FrozenPostings(const std::vector<std::vector<uint32_t>> &lists);
+  // the vectors keep their buffers when moved, so the views stay valid
+  FrozenPostings(FrozenPostings &&) = default;
+  FrozenPostings &operator=(FrozenPostings &&) = default;
+
+  bool empty() const { return offsets_.empty(); }
+  // number of lists
+  size_t size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+  PostingList operator[](size_t i) const {
+    return {data_.data() + offsets_[i], data_.data() + offsets_[i + 1]};
+  }
+  // heap bytes, none for a view
+  size_t bytes() const {
+    return owned_offsets_.capacity() * sizeof(uint32_t) +
+           owned_data_.capacity();
+  }
+
+  // the packed stream, for persisting it
+  std::span<const uint32_t> offsets() const { return offsets_; }
+  std::span<const uint8_t> data() const { return data_; }
+  // views a persisted stream of lists lists, which must outlive this;
+  // false and left empty if it is malformed or holds an entry not below
+  // id_limit
+  bool View(std::span<const uint32_t> offsets, std::span<const uint8_t> data,
+            size_t lists, uint32_t id_limit);
+
+private:
+  // offsets[i] -> start of list i in data, offsets[size()] -> data.size()
+  std::span<const uint32_t> offsets_;
+  std::span<const uint8_t> data_;
+  // backing offsets and data unless this is a view
+  std::vector<uint32_t> owned_offsets_;
+  std::vector<uint8_t> owned_data_;
+};
+
+inline void PostingList::iterator::Load() {
+  if (ptr_ == end_)
+    return;
+  if (!packed_) {
+    value_ = *reinterpret_cast<const uint32_t *>(ptr_);
+    next_ = ptr_ + sizeof(uint32_t);
+    return;
+  }
+  uint32_t zigzag = 0;
+  const uint8_t *p = ptr_;
+  for (unsigned shift = 0;; shift += 7) {
+    uint8_t byte = *p++;
+    zigzag |= uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      break;
+  }
+  next_ = p;
+  // the first entry is relative to 0, value_'s initial state
+  value_ += (zigzag >> 1) ^ -(zigzag & 1);
+}
@@ -0,0 +1,303 @@
+#include <cstring>
+
+#include "query_log.h"
+
+namespace query_log {
+
+namespace {
+constexpr char kMagic[8] = {'D', 'X', 'Q', 'L', 'O', 'G', '0', '3'};
+// flush the buffered records once they exceed this
+constexpr size_t kBufferSize = 64 * 1024;
+
+class Encoder {
+public:
+  explicit Encoder(std::vector<uint8_t> &out) : out_(out) {}
+
+  void operator()(size_t value) { Uint(value); }
+  void operator()(bool value) { out_.emplace_back(value); }
+  void operator()(const std::string &value) {
+    Uint(value.size());
+    out_.insert(out_.end(), value.begin(), value.end());
+  }
+  void operator()(const std::vector<size_t> &values) {
+    Uint(values.size());
+    for (auto value : values)
+      Uint(value);
+  }
+  void operator()(const std::vector<std::string> &values) {
+    Uint(values.size());
+    for (auto &value : values)
+      (*this)(value);
+  }
+  void Index(size_t value) { Uint(uint64_t(value) + 1); }
+  void Count(short value) { Uint(uint16_t(value + 1)); }
+  void Elapsed(double ms) { Uint(uint64_t(ms * 1e6)); }
+  bool ok() const { return true; }
+
+private:
+  void Uint(uint64_t value) {
+    do {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;
+      out_.emplace_back(byte | (value ? 0x80 : 0));
+    } while (value);
+  }
+
+  std::vector<uint8_t> &out_;
+};
+
+class Decoder {
+public:
+  Decoder(const uint8_t *begin, const uint8_t *end) : ptr_(begin), end_(end) {}
+
+  uint64_t Uint() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; ok_; shift += 7) {
+      if (ptr_ == end_ || shift > 63) {
+        ok_ = false;
+        break;
+      }
+      auto byte = *ptr_++;
+      value |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    return value;
+  }
+  void operator()(bool &value) { value = Uint(); }
+  void operator()(size_t &value) { value = Uint(); }
+  void operator()(std::string &value) {
+    auto size = Uint();
+    if (!ok_ || size > uint64_t(end_ - ptr_)) {
+      ok_ = false;
+      return;
+    }
+    value.assign(reinterpret_cast<const char *>(ptr_), size);
+    ptr_ += size;
+  }
+  void operator()(std::vector<size_t> &values) {
+    auto size = Uint();
+    // every element takes at least a byte
+    if (!ok_ || size > uint64_t(end_ - ptr_)) {
+      ok_ = false;
+      return;
+    }
+    values.resize(size);
+    for (auto &value : values)
+      value = Uint();
+  }
+  void operator()(std::vector<std::string> &values) {
+    auto size = Uint();
+    if (!ok_ || size > uint64_t(end_ - ptr_)) {
+      ok_ = false;
+      return;
+    }
+    values.resize(size);
+    for (auto &value : values)
+      (*this)(value);
+  }
+  void Index(size_t &value) { value = Uint() - 1; }
+  void Count(short &value) { value = short(Uint() - 1); }
+  void Elapsed(double &ms) { ms = Uint() / 1e6; }
+  bool ok() const { return ok_; }
+  bool done() const { return ptr_ == end_; }
+
+private:
+  const uint8_t *ptr_;
+  const uint8_t *end_;
+  bool ok_ = true;
+};
+
+template <class IO, class R> void Filter(IO &io, R &record) {
+  io.Index(record.return_type);
+  io.Count(record.parameter_count);
+  io(record.parameter_shorty);
+  io.Index(record.declaring_class);
+  io(record.parameter_types);
+  io(record.contains_parameter_types);
+  io(record.dex_priority);
+  io(record.find_first);
+}
+
+// the field layout of each op, shared by the encoder and the decoder
+template <class IO, class R> bool Fields(IO &io, R &record) {
+  io(record.session);
+  switch (record.op) {
+  case kOpen:
+    io(record.checksums);
+    io(record.prefetch);
+    io(record.memory_budget);
+    io(record.relations);
+    break;
+  case kCreateClassIndex:
+    io(record.class_name);
+    io.Index(record.on_dex);
+    break;
+  case kCreateMethodIndex:
+    io(record.class_name);
+    io(record.member_name);
+    io(record.params_name);
+    io.Index(record.on_dex);
+    break;
+  case kCreateFieldIndex:
+    io(record.class_name);
+    io(record.member_name);
+    io.Index(record.on_dex);
+    break;
+  case kFindMethodUsingString:
+    io(record.str);
+    io(record.match_prefix);
+    Filter(io, record);
+    break;
+  case kFindMethodSetUsingString:
+    io(record.str);
+    io(record.match_prefix);
+    break;
+  case kFindMethodSetInvoking:
+  case kFindMethodSetInvoked:
+  case kFindMethodSetGettingField:
+  case kFindMethodSetSettingField:
+  case kFindMethodSetOfClass:
+    io.Index(record.target);
+    break;
+  case kFindMethodSetMatching:
+    Filter(io, record);
+    break;
+  case kFindMethodInvoking:
+  case kFindMethodInvoked:
+  case kFindMethodGettingField:
+  case kFindMethodSettingField:
+    io.Index(record.target);
+    Filter(io, record);
+    break;
+  case kFindField:
+    io.Index(record.target);
+    io(record.dex_priority);
+    io(record.find_first);
+    break;
+  case kCreateFullCache:
+    io(record.relations);
+    break;
+  case kSetMemoryBudget:
+    io(record.memory_budget);
+    break;
+  case kAddDex:
+    io(record.checksums);
+    break;
+  case kRemoveDex:
+    io.Index(record.on_dex);
+    break;
+  default:
+    return false;
+  }
+  io(record.result);
+  io.Elapsed(record.elapsed_ms);
+  return io.ok();
+}
+} // namespace
+
+const char *OpName(Op op) {
+  static constexpr const char *kNames[] = {
+      "Open",
+      "CreateClassIndex",
+      "CreateMethodIndex",
+      "CreateFieldIndex",
+      "FindMethodUsingString",
+      "FindMethodInvoking",
+      "FindMethodInvoked",
+      "FindMethodGettingField",
+      "FindMethodSettingField",
+      "FindField",
+      "CreateFullCache",
+      "SetMemoryBudget",
+      "AddDex",
+      "RemoveDex",
+      "FindMethodSetUsingString",
+      "FindMethodSetInvoking",
+      "FindMethodSetInvoked",
+      "FindMethodSetGettingField",
+      "FindMethodSetSettingField",
+      "FindMethodSetOfClass",
+      "FindMethodSetMatching",
+  };
+  static_assert(sizeof(kNames) / sizeof(*kNames) == kOpCount);
+  return op < kOpCount ? kNames[op] : "?";
+}
+
+Writer::Writer(const char *path) : out_(fopen(path, "wb")) {
+  if (out_ && fwrite(kMagic, sizeof(kMagic), 1, out_) != 1) {
+    fclose(out_);
+    out_ = nullptr;
+  }
+}
+
+Writer::~Writer() {
+  if (!out_)
+    return;
+  Flush();
+  fclose(out_);
+}
+
+size_t Writer::NewSession() {
+  std::lock_guard lock(mutex_);
+  return sessions_++;
+}
+
+void Writer::Append(const Record &record) {
+  if (!out_)
+    return;
+  std::lock_guard lock(mutex_);
+  Encode(record, buffer_);
+  if (buffer_.size() >= kBufferSize) {
+    fwrite(buffer_.data(), 1, buffer_.size(), out_);
+    buffer_.clear();
+  }
+}
+
+bool Writer::Flush() {
+  if (!out_)
+    return false;
+  std::lock_guard lock(mutex_);
+  bool ok = fwrite(buffer_.data(), 1, buffer_.size(), out_) == buffer_.size();
+  buffer_.clear();
+  return fflush(out_) == 0 && ok;
+}
+
+bool Read(const char *path, std::vector<Record> &records) {
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return false;
+  std::vector<uint8_t> data;
+  uint8_t chunk[64 * 1024];
+  for (size_t n; (n = fread(chunk, 1, sizeof(chunk), in)) > 0;)
+    data.insert(data.end(), chunk, chunk + n);
+  fclose(in);
+  if (data.size() < sizeof(kMagic) ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0)
+    return false;
+
+  Decoder decoder(data.data() + sizeof(kMagic), data.data() + data.size());
+  while (!decoder.done()) {
+    Record record;
+    record.op = Op(decoder.Uint());
+    // a truncated tail is what a crashed process leaves behind
+    if (!decoder.ok() || !Fields(decoder, record))
+      break;
+    records.emplace_back(std::move(record));
+  }
+  return true;
+}
+
+void Encode(const Record &record, std::vector<uint8_t> &out) {
+  out.emplace_back(record.op);
+  Encoder encoder(out);
+  Fields(encoder, record);
+}
+
+bool Decode(const uint8_t *begin, const uint8_t *end, Record &record) {
+  Decoder decoder(begin, end);
+  record.op = Op(decoder.Uint());
+  return decoder.ok() && Fields(decoder, record) && decoder.done();
+}
+
+} // namespace query_log
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Compact binary log of DexHelper API calls, captured in production and
+// re-run offline by the replay tool (replay.cc).
+//
+// A log is a magic followed by records. Integers are ULEB128, indices that
+// may be size_t(-1) are stored plus one, strings and vectors are prefixed
+// by their length; each op only stores the fields it uses.
+namespace query_log {
+
+enum Op : uint8_t {
+  // a DexHelper was constructed; starts a new session
+  kOpen,
+  kCreateClassIndex,
+  kCreateMethodIndex,
+  kCreateFieldIndex,
+  kFindMethodUsingString,
+  kFindMethodInvoking,
+  kFindMethodInvoked,
+  kFindMethodGettingField,
+  kFindMethodSettingField,
+  kFindField,
+  kCreateFullCache,
+  kSetMemoryBudget,
+  kAddDex,
+  kRemoveDex,
+  kFindMethodSetUsingString,
+  kFindMethodSetInvoking,
+  kFindMethodSetInvoked,
+  kFindMethodSetGettingField,
+  kFindMethodSetSettingField,
+  kFindMethodSetOfClass,
+  kFindMethodSetMatching,
+  kOpCount,
+};
+
+const char *OpName(Op op);
+
+struct Record {
+  Op op = kOpen;
+  // the DexHelper that made the call, as Writer::NewSession numbered it
+  size_t session = 0;
+  // kOpen: header checksum of each dex, and the options; kAddDex: the
+  // checksum of the added dex
+  std::vector<size_t> checksums;
+  bool prefetch = true;
+  // kOpen, kSetMemoryBudget
+  size_t memory_budget = 0;
+  // kOpen: DexHelper::Options::relations; kCreateFullCache: the relations
+  // it completes
+  size_t relations = 0;
+
+  // CreateXIndex
+  std::string class_name;
+  // method or field name
+  std::string member_name;
+  std::vector<std::string> params_name;
+  // also the dex of kRemoveDex
+  size_t on_dex = -1;
+
+  // FindMethodUsingString, FindMethodSetUsingString
+  std::string str;
+  bool match_prefix = false;
+  // the method, field or class index searched by the other Find*
+  size_t target = -1;
+  // filters of the Find*
+  size_t return_type = -1;
+  short parameter_count = -1;
+  std::string parameter_shorty;
+  size_t declaring_class = -1;
+  std::vector<size_t> parameter_types;
+  std::vector<size_t> contains_parameter_types;
+  std::vector<size_t> dex_priority;
+  bool find_first = false;
+
+  // the returned index or indices; the FindMethodSet* store the set as
+  // DexHelper::MethodSet::Flatten returns it
+  std::vector<size_t> result;
+  double elapsed_ms = 0;
+};
+
+// Appends records to a file; may be shared by several DexHelpers and
+// threads, whose records interleave and are told apart by their session.
+class Writer {
+public:
+  explicit Writer(const char *path);
+  ~Writer();
+
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  // false if the file could not be created
+  bool ok() const { return out_ != nullptr; }
+  // a session number not given out before, for a new DexHelper
+  size_t NewSession();
+  void Append(const Record &record);
+  bool Flush();
+
+private:
+  std::mutex mutex_;
+  FILE *out_ = nullptr;
+  std::vector<uint8_t> buffer_;
+  size_t sessions_ = 0;
+};
+
+// Reads every complete record of a log, false if path is not a query log.
+bool Read(const char *path, std::vector<Record> &records);
+
+// Appends one record in the log encoding, without the magic; the query
+// server (query_server.h) frames them on its socket.
+void Encode(const Record &record, std::vector<uint8_t> &out);
+// false unless [begin, end) holds exactly one record
+bool Decode(const uint8_t *begin, const uint8_t *end, Record &record);
+
+} // namespace query_log
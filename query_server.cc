@@ -0,0 +1,206 @@
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "query_server.h"
+
+namespace query_server {
+
+std::vector<size_t> Execute(DexHelper &helper,
+                            const query_log::Record &record) {
+  switch (record.op) {
+  case query_log::kCreateClassIndex:
+    return {helper.CreateClassIndex(record.class_name, record.on_dex)};
+  case query_log::kCreateMethodIndex: {
+    std::vector<std::string_view> params_name(record.params_name.begin(),
+                                              record.params_name.end());
+    return {helper.CreateMethodIndex(record.class_name, record.member_name,
+                                     params_name, record.on_dex)};
+  }
+  case query_log::kCreateFieldIndex:
+    return {helper.CreateFieldIndex(record.class_name, record.member_name,
+                                    record.on_dex)};
+  case query_log::kFindMethodUsingString:
+    return helper.FindMethodUsingString(
+        record.str, record.match_prefix, record.return_type,
+        record.parameter_count, record.parameter_shorty,
+        record.declaring_class, record.parameter_types,
+        record.contains_parameter_types, record.dex_priority,
+        record.find_first);
+  case query_log::kFindMethodInvoking:
+    return helper.FindMethodInvoking(
+        record.target, record.return_type, record.parameter_count,
+        record.parameter_shorty, record.declaring_class,
+        record.parameter_types, record.contains_parameter_types,
+        record.dex_priority, record.find_first);
+  case query_log::kFindMethodInvoked:
+    return helper.FindMethodInvoked(
+        record.target, record.return_type, record.parameter_count,
+        record.parameter_shorty, record.declaring_class,
+        record.parameter_types, record.contains_parameter_types,
+        record.dex_priority, record.find_first);
+  case query_log::kFindMethodGettingField:
+    return helper.FindMethodGettingField(
+        record.target, record.return_type, record.parameter_count,
+        record.parameter_shorty, record.declaring_class,
+        record.parameter_types, record.contains_parameter_types,
+        record.dex_priority, record.find_first);
+  case query_log::kFindMethodSettingField:
+    return helper.FindMethodSettingField(
+        record.target, record.return_type, record.parameter_count,
+        record.parameter_shorty, record.declaring_class,
+        record.parameter_types, record.contains_parameter_types,
+        record.dex_priority, record.find_first);
+  case query_log::kFindField:
+    return helper.FindField(record.target, record.dex_priority,
+                            record.find_first);
+  case query_log::kFindMethodSetUsingString:
+    return helper.FindMethodSetUsingString(record.str, record.match_prefix)
+        .Flatten();
+  case query_log::kFindMethodSetInvoking:
+    return helper.FindMethodSetInvoking(record.target).Flatten();
+  case query_log::kFindMethodSetInvoked:
+    return helper.FindMethodSetInvoked(record.target).Flatten();
+  case query_log::kFindMethodSetGettingField:
+    return helper.FindMethodSetGettingField(record.target).Flatten();
+  case query_log::kFindMethodSetSettingField:
+    return helper.FindMethodSetSettingField(record.target).Flatten();
+  case query_log::kFindMethodSetOfClass:
+    return helper.FindMethodSetOfClass(record.target).Flatten();
+  case query_log::kFindMethodSetMatching:
+    return helper
+        .FindMethodSetMatching(record.return_type, record.parameter_count,
+                               record.parameter_shorty, record.declaring_class,
+                               record.parameter_types,
+                               record.contains_parameter_types)
+        .Flatten();
+  case query_log::kCreateFullCache:
+    helper.CreateFullCache(record.relations);
+    return {};
+  case query_log::kSetMemoryBudget:
+    helper.SetMemoryBudget(record.memory_budget);
+    return {};
+  default:
+    return {};
+  }
+}
+
+unsigned ScanRelation(query_log::Op op) {
+  switch (op) {
+  case query_log::kFindMethodUsingString:
+  case query_log::kFindMethodSetUsingString:
+    return DexHelper::kStringRelation;
+  case query_log::kFindMethodInvoked:
+  case query_log::kFindMethodSetInvoked:
+    return DexHelper::kInvokedRelation;
+  case query_log::kFindMethodGettingField:
+  case query_log::kFindMethodSetGettingField:
+    return DexHelper::kGettingRelation;
+  case query_log::kFindMethodSettingField:
+  case query_log::kFindMethodSetSettingField:
+    return DexHelper::kSettingRelation;
+  default:
+    return 0;
+  }
+}
+
+void AppendFrame(const query_log::Record &record, std::vector<uint8_t> &out) {
+  auto start = out.size();
+  out.resize(start + sizeof(uint32_t));
+  query_log::Encode(record, out);
+  uint32_t size = out.size() - start - sizeof(uint32_t);
+  memcpy(&out[start], &size, sizeof(size));
+}
+
+bool TakeFrame(std::vector<uint8_t> &in, query_log::Record &record,
+               bool &error) {
+  uint32_t size;
+  if (in.size() < sizeof(size))
+    return false;
+  memcpy(&size, in.data(), sizeof(size));
+  if (size > kMaxFrame) {
+    error = true;
+    return false;
+  }
+  if (in.size() < sizeof(size) + size)
+    return false;
+  auto *begin = in.data() + sizeof(size);
+  record = {};
+  if (!query_log::Decode(begin, begin + size, record)) {
+    error = true;
+    return false;
+  }
+  in.erase(in.begin(), in.begin() + sizeof(size) + size);
+  return true;
+}
+
+Client::Client(const std::string &socket_path) {
+  sockaddr_un address{.sun_family = AF_UNIX, .sun_path = {}};
+  if (socket_path.size() >= sizeof(address.sun_path))
+    return;
+  memcpy(address.sun_path, socket_path.data(), socket_path.size());
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ != -1 && connect(fd_, reinterpret_cast<sockaddr *>(&address),
+                           sizeof(address)) != 0)
+    Close();
+}
+
+Client::~Client() { Close(); }
+
+void Client::Close() {
+  if (fd_ != -1)
+    close(fd_);
+  fd_ = -1;
+}
+
+bool Client::Send(const std::vector<uint8_t> &data) {
+  for (size_t sent = 0; sent < data.size();) {
+    auto n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+bool Client::Call(const std::vector<query_log::Record> &requests,
+                  std::vector<std::vector<size_t>> &results) {
+  results.clear();
+  if (fd_ == -1)
+    return false;
+  std::vector<uint8_t> out;
+  for (auto &request : requests)
+    AppendFrame(request, out);
+  if (!Send(out)) {
+    Close();
+    return false;
+  }
+  while (results.size() < requests.size()) {
+    query_log::Record response;
+    bool error = false;
+    if (TakeFrame(in_, response, error)) {
+      results.emplace_back(std::move(response.result));
+      continue;
+    }
+    uint8_t chunk[64 * 1024];
+    auto n = error ? 0 : recv(fd_, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      Close();
+      return false;
+    }
+    in_.insert(in_.end(), chunk, chunk + n);
+  }
+  return true;
+}
+
+bool Client::Call(const query_log::Record &request,
+                  std::vector<size_t> &result) {
+  std::vector<std::vector<size_t>> results;
+  if (!Call(std::vector<query_log::Record>{request}, results))
+    return false;
+  result = std::move(results.front());
+  return true;
+}
+
+} // namespace query_server
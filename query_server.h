@@ -0,0 +1,63 @@
+#pragma once
+
+#include "dex_helper.h"
+#include "query_log.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Protocol of the query server (server.cc), which keeps a DexHelper warm
+// for short-lived clients on the same machine.
+//
+// Both directions carry frames over a Unix stream socket: a uint32_t byte
+// count in native byte order, then one query_log record. A request record
+// holds the arguments of a call and a response record the result and the
+// time the server spent on it. Responses come back in request order.
+namespace query_server {
+
+// a frame longer than this ends the connection
+constexpr uint32_t kMaxFrame = 16 << 20;
+
+// Runs one recorded call, as the server and the replay tool do; ops that
+// do not query (Open, AddDex, RemoveDex) return nothing.
+std::vector<size_t> Execute(DexHelper &helper, const query_log::Record &record);
+
+// the DexHelper::Relation the call scans bytecode for the first time it
+// meets a dex, 0 if it does not scan
+unsigned ScanRelation(query_log::Op op);
+
+// appends the frame of record to out
+void AppendFrame(const query_log::Record &record, std::vector<uint8_t> &out);
+// Takes the first complete frame off the front of in. False if there is
+// none yet; a malformed frame sets error.
+bool TakeFrame(std::vector<uint8_t> &in, query_log::Record &record,
+               bool &error);
+
+class Client {
+public:
+  // empty if the server cannot be reached
+  explicit Client(const std::string &socket_path);
+  ~Client();
+
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  bool ok() const { return fd_ != -1; }
+
+  // Sends every request before reading a response, so the server sees
+  // them together and may batch their scans. False if the connection
+  // failed; it is closed then.
+  bool Call(const std::vector<query_log::Record> &requests,
+            std::vector<std::vector<size_t>> &results);
+  bool Call(const query_log::Record &request, std::vector<size_t> &result);
+
+private:
+  bool Send(const std::vector<uint8_t> &data);
+  void Close();
+
+  int fd_ = -1;
+  std::vector<uint8_t> in_;
+};
+
+} // namespace query_server
@@ -0,0 +1,206 @@
+#include "apk_loader.h"
+#include "dex_helper.h"
+#include "query_log.h"
+#include "query_server.h"
+#include "slicer/chronometer.h"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Re-runs a query log (see query_log.h) against the dex files it was
+// recorded on, timing every call and checking it returns the same results.
+//
+// usage: replay LOG [APK | DEX_DIR] [--iterations=N] [--no-verify]
+
+namespace {
+
+struct OpStats {
+  size_t calls = 0;
+  size_t mismatches = 0;
+  double recorded_ms = 0;
+  double replayed_ms = 0;
+};
+
+std::string Describe(const query_log::Record &record) {
+  std::string out = query_log::OpName(record.op);
+  out += '(';
+  if (!record.class_name.empty())
+    out += record.class_name + ' ' + record.member_name;
+  else if (!record.str.empty())
+    out += '"' + record.str + '"';
+  else if (record.target != size_t(-1))
+    out += std::to_string(record.target);
+  return out + ')';
+}
+
+std::string Format(const std::vector<size_t> &indices) {
+  std::string out = "[";
+  for (size_t i = 0; i < indices.size() && i < 8; ++i)
+    out += (i ? " " : "") + std::to_string(indices[i]);
+  return out + (indices.size() > 8 ? " ...]" : "]");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const char *log_path = nullptr;
+  std::string_view dex_path = "dexs";
+  size_t iterations = 1;
+  bool verify = true;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 13) == "--iterations=") {
+      iterations = std::strtoull(argv[i] + 13, nullptr, 10);
+    } else if (arg == "--no-verify") {
+      verify = false;
+    } else if (!log_path) {
+      log_path = argv[i];
+    } else {
+      dex_path = arg;
+    }
+  }
+  if (!log_path) {
+    fprintf(stderr,
+            "usage: %s LOG [APK | DEX_DIR] [--iterations=N] [--no-verify]\n",
+            argv[0]);
+    return 1;
+  }
+
+  std::vector<query_log::Record> records;
+  if (!query_log::Read(log_path, records)) {
+    fprintf(stderr, "%s: not a query log\n", log_path);
+    return 1;
+  }
+
+  std::vector<std::tuple<const void *, size_t>> dexs;
+  std::unique_ptr<ApkLoader> apk;
+  if (dex_path.ends_with(".apk")) {
+    apk = std::make_unique<ApkLoader>(dex_path);
+    dexs = apk->Dexes();
+  }
+  for (int i = 1; i <= 100 && !apk; ++i) {
+    std::string path = std::string(dex_path) + "/classes" +
+                       (i == 1 ? std::string("") : std::to_string(i)) + ".dex";
+    int raw_dex = open(path.data(), O_RDONLY);
+    if (raw_dex == -1)
+      break;
+    struct stat s {};
+    fstat(raw_dex, &s);
+    dexs.emplace_back(
+        mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, raw_dex, 0),
+        s.st_size);
+    close(raw_dex);
+  }
+
+  // index in dexs of the dex with the header checksum, dexs.size() if none
+  auto find_dex = [&dexs](size_t checksum) {
+    size_t i = 0;
+    while (i < dexs.size() &&
+           static_cast<const dex::Header *>(std::get<0>(dexs[i]))->checksum !=
+               checksum)
+      ++i;
+    return i;
+  };
+
+  std::array<OpStats, query_log::kOpCount> stats{};
+  size_t reported = 0;
+  for (size_t iteration = 0; iteration < iterations; ++iteration) {
+    // the helper of each session the log opened
+    std::map<size_t, DexHelper> helpers;
+    for (auto &record : records) {
+      auto &op = stats[record.op];
+      ++op.calls;
+      op.recorded_ms += record.elapsed_ms;
+      if (record.op == query_log::kOpen) {
+        // dexes added later are loaded too, so find the opened ones
+        std::vector<std::tuple<const void *, size_t>> opened;
+        for (auto checksum : record.checksums) {
+          auto i = find_dex(checksum);
+          if (i == dexs.size()) {
+            fprintf(stderr, "dex %zu of the log is not loaded\n",
+                    opened.size());
+            return 1;
+          }
+          opened.emplace_back(dexs[i]);
+        }
+        helpers.erase(record.session);
+        slicer::Chronometer chronometer(op.replayed_ms, true);
+        helpers.try_emplace(record.session, opened,
+                            DexHelper::Options{
+                                .prefetch = record.prefetch,
+                                .memory_budget = record.memory_budget,
+                                .relations = unsigned(record.relations)});
+        continue;
+      }
+      auto it = helpers.find(record.session);
+      if (it == helpers.end()) {
+        fprintf(stderr, "%s before the Open of session %zu\n",
+                query_log::OpName(record.op), record.session);
+        return 1;
+      }
+      auto &helper = it->second;
+      if (record.op == query_log::kSetMemoryBudget) {
+        slicer::Chronometer chronometer(op.replayed_ms, true);
+        helper.SetMemoryBudget(record.memory_budget);
+        continue;
+      }
+      if (record.op == query_log::kAddDex) {
+        if (record.checksums.size() != 1) {
+          fprintf(stderr, "AddDex of session %zu has %zu checksums\n",
+                  record.session, record.checksums.size());
+          return 1;
+        }
+        auto i = find_dex(record.checksums[0]);
+        if (i == dexs.size()) {
+          fprintf(stderr, "added dex of the log is not loaded\n");
+          return 1;
+        }
+        slicer::Chronometer chronometer(op.replayed_ms, true);
+        helper.AddDex(std::get<0>(dexs[i]), std::get<1>(dexs[i]));
+        continue;
+      }
+      if (record.op == query_log::kRemoveDex) {
+        slicer::Chronometer chronometer(op.replayed_ms, true);
+        helper.RemoveDex(record.on_dex);
+        continue;
+      }
+      std::vector<size_t> result;
+      {
+        slicer::Chronometer chronometer(op.replayed_ms, true);
+        result = query_server::Execute(helper, record);
+      }
+      if (verify && result != record.result) {
+        ++op.mismatches;
+        if (reported++ < 10) {
+          fprintf(stderr, "mismatch: %s recorded %s replayed %s\n",
+                  Describe(record).c_str(), Format(record.result).c_str(),
+                  Format(result).c_str());
+        }
+      }
+    }
+  }
+
+  size_t mismatches = 0;
+  printf("%-26s %8s %12s %12s %10s\n", "op", "calls", "recorded ms",
+         "replayed ms", "mismatch");
+  for (size_t op = 0; op < query_log::kOpCount; ++op) {
+    auto &s = stats[op];
+    if (s.calls == 0)
+      continue;
+    printf("%-26s %8zu %12.3f %12.3f %10zu\n",
+           query_log::OpName(query_log::Op(op)), s.calls, s.recorded_ms,
+           s.replayed_ms, s.mismatches);
+    mismatches += s.mismatches;
+  }
+  return mismatches ? 2 : 0;
+}
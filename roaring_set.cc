@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <iterator>
+
+#include "roaring_set.h"
+
+namespace {
+constexpr auto kByKey = [](const auto &container, uint16_t key) {
+  return container.key < key;
+};
+} // namespace
+
+RoaringSet::RoaringSet(const std::vector<uint32_t> &ids) {
+  auto sorted = ids;
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  for (auto id : sorted) {
+    uint16_t key = id >> 16;
+    if (containers_.empty() || containers_.back().key != key)
+      containers_.push_back(
+          {.key = key, .cardinality = 0, .array = {}, .bitmap = {}});
+    containers_.back().array.emplace_back(id & 0xffff);
+  }
+  for (auto &container : containers_) {
+    container.cardinality = container.array.size();
+    container.Normalize();
+  }
+}
+
+auto RoaringSet::Find(uint16_t key) -> Container * {
+  auto iter =
+      std::lower_bound(containers_.begin(), containers_.end(), key, kByKey);
+  return iter != containers_.end() && iter->key == key ? &*iter : nullptr;
+}
+
+auto RoaringSet::Find(uint16_t key) const -> const Container * {
+  return const_cast<RoaringSet *>(this)->Find(key);
+}
+
+bool RoaringSet::Container::Contains(uint16_t low) const {
+  if (!bitmap.empty())
+    return bitmap[low / 64] >> (low % 64) & 1;
+  return std::binary_search(array.begin(), array.end(), low);
+}
+
+void RoaringSet::Container::Normalize() {
+  if (bitmap.empty() && cardinality > kArrayMax) {
+    ToBitmap(*this);
+  } else if (!bitmap.empty() && cardinality <= kArrayMax) {
+    array.clear();
+    array.reserve(cardinality);
+    for (size_t word = 0; word < kBitmapWords; ++word) {
+      for (auto bits = bitmap[word]; bits; bits &= bits - 1)
+        array.emplace_back(word * 64 + __builtin_ctzll(bits));
+    }
+    std::vector<uint64_t>().swap(bitmap);
+  }
+}
+
+void RoaringSet::ToBitmap(Container &container) {
+  if (!container.bitmap.empty())
+    return;
+  container.bitmap.assign(kBitmapWords, 0);
+  for (auto low : container.array)
+    container.bitmap[low / 64] |= uint64_t(1) << (low % 64);
+  std::vector<uint16_t>().swap(container.array);
+}
+
+void RoaringSet::Add(uint32_t id) {
+  uint16_t key = id >> 16, low = id & 0xffff;
+  auto iter =
+      std::lower_bound(containers_.begin(), containers_.end(), key, kByKey);
+  if (iter == containers_.end() || iter->key != key)
+    iter = containers_.insert(
+        iter,
+        Container{.key = key, .cardinality = 0, .array = {}, .bitmap = {}});
+  auto &container = *iter;
+  if (!container.bitmap.empty()) {
+    auto &word = container.bitmap[low / 64];
+    auto bit = uint64_t(1) << (low % 64);
+    container.cardinality += !(word & bit);
+    word |= bit;
+    return;
+  }
+  auto pos = std::lower_bound(container.array.begin(), container.array.end(),
+                              low);
+  if (pos != container.array.end() && *pos == low)
+    return;
+  container.array.insert(pos, low);
+  ++container.cardinality;
+  container.Normalize();
+}
+
+bool RoaringSet::Contains(uint32_t id) const {
+  auto *container = Find(id >> 16);
+  return container && container->Contains(id & 0xffff);
+}
+
+size_t RoaringSet::size() const {
+  size_t size = 0;
+  for (auto &container : containers_)
+    size += container.cardinality;
+  return size;
+}
+
+size_t RoaringSet::bytes() const {
+  size_t bytes = containers_.capacity() * sizeof(Container);
+  for (auto &container : containers_) {
+    bytes += container.array.capacity() * sizeof(uint16_t) +
+             container.bitmap.capacity() * sizeof(uint64_t);
+  }
+  return bytes;
+}
+
+std::vector<uint32_t> RoaringSet::ToVector() const {
+  std::vector<uint32_t> out;
+  out.reserve(size());
+  ForEach([&out](uint32_t id) { out.emplace_back(id); });
+  return out;
+}
+
+bool RoaringSet::operator==(const RoaringSet &other) const {
+  if (containers_.size() != other.containers_.size())
+    return false;
+  for (size_t i = 0; i < containers_.size(); ++i) {
+    auto &a = containers_[i], &b = other.containers_[i];
+    // normalized, so equal sets use the same representation
+    if (a.key != b.key || a.cardinality != b.cardinality ||
+        a.array != b.array || a.bitmap != b.bitmap)
+      return false;
+  }
+  return true;
+}
+
+void RoaringSet::And(Container &a, const Container &b) {
+  if (!a.bitmap.empty() && !b.bitmap.empty()) {
+    a.cardinality = 0;
+    for (size_t word = 0; word < kBitmapWords; ++word) {
+      a.bitmap[word] &= b.bitmap[word];
+      a.cardinality += __builtin_popcountll(a.bitmap[word]);
+    }
+  } else if (!a.bitmap.empty()) {
+    // the result is no larger than b's array
+    std::vector<uint16_t> array;
+    for (auto low : b.array) {
+      if (a.Contains(low))
+        array.emplace_back(low);
+    }
+    std::vector<uint64_t>().swap(a.bitmap);
+    a.array = std::move(array);
+    a.cardinality = a.array.size();
+  } else if (!b.bitmap.empty()) {
+    std::erase_if(a.array, [&b](uint16_t low) { return !b.Contains(low); });
+    a.cardinality = a.array.size();
+  } else {
+    std::vector<uint16_t> array;
+    std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(),
+                          b.array.end(), std::back_inserter(array));
+    a.array = std::move(array);
+    a.cardinality = a.array.size();
+  }
+  a.Normalize();
+}
+
+void RoaringSet::Or(Container &a, const Container &b) {
+  if (a.bitmap.empty() && b.bitmap.empty() &&
+      a.cardinality + b.cardinality <= kArrayMax) {
+    std::vector<uint16_t> array;
+    array.reserve(a.cardinality + b.cardinality);
+    std::set_union(a.array.begin(), a.array.end(), b.array.begin(),
+                   b.array.end(), std::back_inserter(array));
+    a.array = std::move(array);
+    a.cardinality = a.array.size();
+    return;
+  }
+  ToBitmap(a);
+  if (!b.bitmap.empty()) {
+    for (size_t word = 0; word < kBitmapWords; ++word)
+      a.bitmap[word] |= b.bitmap[word];
+  } else {
+    for (auto low : b.array)
+      a.bitmap[low / 64] |= uint64_t(1) << (low % 64);
+  }
+  a.cardinality = 0;
+  for (auto word : a.bitmap)
+    a.cardinality += __builtin_popcountll(word);
+  a.Normalize();
+}
+
+void RoaringSet::AndNot(Container &a, const Container &b) {
+  if (!a.bitmap.empty()) {
+    if (!b.bitmap.empty()) {
+      for (size_t word = 0; word < kBitmapWords; ++word)
+        a.bitmap[word] &= ~b.bitmap[word];
+    } else {
+      for (auto low : b.array)
+        a.bitmap[low / 64] &= ~(uint64_t(1) << (low % 64));
+    }
+    a.cardinality = 0;
+    for (auto word : a.bitmap)
+      a.cardinality += __builtin_popcountll(word);
+  } else if (!b.bitmap.empty()) {
+    std::erase_if(a.array, [&b](uint16_t low) { return b.Contains(low); });
+    a.cardinality = a.array.size();
+  } else {
+    std::vector<uint16_t> array;
+    std::set_difference(a.array.begin(), a.array.end(), b.array.begin(),
+                        b.array.end(), std::back_inserter(array));
+    a.array = std::move(array);
+    a.cardinality = a.array.size();
+  }
+  a.Normalize();
+}
+
+RoaringSet &RoaringSet::operator&=(const RoaringSet &other) {
+  std::vector<Container> out;
+  auto b = other.containers_.begin();
+  for (auto &a : containers_) {
+    while (b != other.containers_.end() && b->key < a.key)
+      ++b;
+    if (b == other.containers_.end())
+      break;
+    if (b->key != a.key)
+      continue;
+    And(a, *b);
+    if (a.cardinality)
+      out.emplace_back(std::move(a));
+  }
+  containers_ = std::move(out);
+  return *this;
+}
+
+RoaringSet &RoaringSet::operator|=(const RoaringSet &other) {
+  std::vector<Container> out;
+  out.reserve(containers_.size() + other.containers_.size());
+  auto a = containers_.begin();
+  auto b = other.containers_.begin();
+  while (a != containers_.end() || b != other.containers_.end()) {
+    if (b == other.containers_.end() ||
+        (a != containers_.end() && a->key < b->key)) {
+      out.emplace_back(std::move(*a++));
+    } else if (a == containers_.end() || b->key < a->key) {
+      out.emplace_back(*b++);
+    } else {
+      Or(*a, *b++);
+      out.emplace_back(std::move(*a++));
+    }
+  }
+  containers_ = std::move(out);
+  return *this;
+}
+
+RoaringSet &RoaringSet::operator-=(const RoaringSet &other) {
+  std::vector<Container> out;
+  auto b = other.containers_.begin();
+  for (auto &a : containers_) {
+    while (b != other.containers_.end() && b->key < a.key)
+      ++b;
+    if (b != other.containers_.end() && b->key == a.key)
+      AndNot(a, *b);
+    if (a.cardinality)
+      out.emplace_back(std::move(a));
+  }
+  containers_ = std::move(out);
+  return *this;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Roaring-style set of 32-bit ids. Ids are grouped by their high 16 bits
+// into containers keeping the low halves either as a sorted array, while
+// there are at most kArrayMax of them, or as a 65536-bit bitmap. Dex
+// method ids fit in a single container.
+class RoaringSet {
+public:
+  RoaringSet() = default;
+  // ids in any order, duplicates allowed
+  explicit RoaringSet(const std::vector<uint32_t> &ids);
+
+  void Add(uint32_t id);
+  bool Contains(uint32_t id) const;
+  bool empty() const { return containers_.empty(); }
+  size_t size() const;
+  size_t bytes() const;
+
+  // in increasing order
+  template <class F> void ForEach(F &&f) const {
+    for (auto &container : containers_) {
+      uint32_t high = uint32_t(container.key) << 16;
+      if (container.bitmap.empty()) {
+        for (auto low : container.array)
+          f(high | low);
+        continue;
+      }
+      for (size_t word = 0; word < kBitmapWords; ++word) {
+        for (auto bits = container.bitmap[word]; bits; bits &= bits - 1)
+          f(high | uint32_t(word * 64 + __builtin_ctzll(bits)));
+      }
+    }
+  }
+  std::vector<uint32_t> ToVector() const;
+
+  RoaringSet &operator&=(const RoaringSet &other);
+  RoaringSet &operator|=(const RoaringSet &other);
+  // and not
+  RoaringSet &operator-=(const RoaringSet &other);
+
+  friend RoaringSet operator&(RoaringSet a, const RoaringSet &b) {
+    return a &= b;
+  }
+  friend RoaringSet operator|(RoaringSet a, const RoaringSet &b) {
+    return a |= b;
+  }
+  friend RoaringSet operator-(RoaringSet a, const RoaringSet &b) {
+    return a -= b;
+  }
+  bool operator==(const RoaringSet &other) const;
+
+private:
+  static constexpr size_t kArrayMax = 4096;
+  static constexpr size_t kBitmapWords = 65536 / 64;
+
+  struct Container {
+    uint16_t key = 0;
+    size_t cardinality = 0;
+    // sorted low halves, unless the bitmap is in use
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bitmap;
+
+    bool Contains(uint16_t low) const;
+    // switches to the cheaper representation for the cardinality
+    void Normalize();
+  };
+
+  Container *Find(uint16_t key);
+  const Container *Find(uint16_t key) const;
+
+  static void ToBitmap(Container &container);
+  static void And(Container &a, const Container &b);
+  static void Or(Container &a, const Container &b);
+  static void AndNot(Container &a, const Container &b);
+
+  // sorted by key, none empty
+  std::vector<Container> containers_;
+};
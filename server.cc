@@ -0,0 +1,205 @@
+#include "apk_loader.h"
+#include "dex_helper.h"
+#include "query_server.h"
+#include "slicer/chronometer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Keeps a DexHelper warm for short-lived clients: loads the dex files once
+// and serves the query_server.h protocol on a Unix socket. Requests that
+// arrive together, from one client or several, are run as a batch; a batch
+// with several scanning queries first scans every dex in one sequential
+// pass for the relations they search, after which each query is answered
+// from the caches.
+//
+// usage: server SOCKET [APK | DEX_DIR] [--batch-scans=N]
+
+namespace {
+
+struct Connection {
+  int fd;
+  std::vector<uint8_t> in;
+  std::vector<uint8_t> out;
+  bool closed = false;
+};
+
+struct Request {
+  size_t connection;
+  query_log::Record record;
+};
+
+// reads what the client sent so far, queueing its complete requests
+void Receive(size_t index, Connection &connection,
+             std::vector<Request> &batch) {
+  uint8_t chunk[64 * 1024];
+  for (;;) {
+    auto n = recv(connection.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (n > 0) {
+      connection.in.insert(connection.in.end(), chunk, chunk + n);
+      continue;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      connection.closed = true;
+    break;
+  }
+  query_log::Record record;
+  bool error = false;
+  while (query_server::TakeFrame(connection.in, record, error))
+    batch.push_back({.connection = index, .record = std::move(record)});
+  if (error)
+    connection.closed = true;
+}
+
+// writes as much of the pending responses as the socket takes
+void Flush(Connection &connection) {
+  auto &out = connection.out;
+  size_t sent = 0;
+  while (sent < out.size()) {
+    auto n = send(connection.fd, out.data() + sent, out.size() - sent,
+                  MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n <= 0) {
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        connection.closed = true;
+      break;
+    }
+    sent += n;
+  }
+  out.erase(out.begin(), out.begin() + sent);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const char *socket_path = nullptr;
+  std::string_view dex_path = "dexs";
+  size_t batch_scans = 4;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.substr(0, 14) == "--batch-scans=") {
+      batch_scans = std::strtoull(argv[i] + 14, nullptr, 10);
+    } else if (!socket_path) {
+      socket_path = argv[i];
+    } else {
+      dex_path = arg;
+    }
+  }
+  sockaddr_un address{.sun_family = AF_UNIX, .sun_path = {}};
+  if (!socket_path || strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "usage: %s SOCKET [APK | DEX_DIR] [--batch-scans=N]\n",
+            argv[0]);
+    return 1;
+  }
+  strcpy(address.sun_path, socket_path);
+
+  std::vector<std::tuple<const void *, size_t>> dexs;
+  std::unique_ptr<ApkLoader> apk;
+  if (dex_path.ends_with(".apk")) {
+    apk = std::make_unique<ApkLoader>(dex_path);
+    dexs = apk->Dexes();
+  }
+  for (int i = 1; i <= 100 && !apk; ++i) {
+    std::string path = std::string(dex_path) + "/classes" +
+                       (i == 1 ? std::string("") : std::to_string(i)) + ".dex";
+    int raw_dex = open(path.data(), O_RDONLY);
+    if (raw_dex == -1)
+      break;
+    struct stat s {};
+    fstat(raw_dex, &s);
+    dexs.emplace_back(
+        mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, raw_dex, 0),
+        s.st_size);
+    close(raw_dex);
+  }
+  if (dexs.empty()) {
+    fprintf(stderr, "no dex files in %s\n", std::string(dex_path).c_str());
+    return 1;
+  }
+  DexHelper helper(dexs);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  // a socket file left behind by an earlier server
+  unlink(socket_path);
+  if (listener == -1 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    fprintf(stderr, "cannot listen on %s: %s\n", socket_path,
+            strerror(errno));
+    return 1;
+  }
+  fprintf(stderr, "serving %zu dexes on %s\n", dexs.size(), socket_path);
+
+  std::vector<Connection> connections;
+  std::vector<pollfd> fds;
+  std::vector<Request> batch;
+  for (;;) {
+    fds.assign(1, {.fd = listener, .events = POLLIN, .revents = 0});
+    for (auto &connection : connections) {
+      short events = POLLIN | (connection.out.empty() ? 0 : POLLOUT);
+      fds.push_back({.fd = connection.fd, .events = events, .revents = 0});
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "poll: %s\n", strerror(errno));
+      return 1;
+    }
+
+    // fds[i + 1] is the poll entry of connections[i]
+    batch.clear();
+    for (size_t i = 0; i < connections.size(); ++i) {
+      if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+        Receive(i, connections[i], batch);
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd != -1)
+        connections.push_back({.fd = fd, .in = {}, .out = {}, .closed = false});
+    }
+
+    size_t scans = 0;
+    unsigned relations = 0;
+    for (auto &request : batch) {
+      auto relation = query_server::ScanRelation(request.record.op);
+      scans += relation != 0;
+      relations |= relation;
+    }
+    if (batch_scans != 0 && scans >= batch_scans)
+      helper.CreateFullCache(relations);
+    for (auto &request : batch) {
+      query_log::Record response;
+      response.op = request.record.op;
+      {
+        slicer::Chronometer chronometer(response.elapsed_ms);
+        response.result = query_server::Execute(helper, request.record);
+      }
+      query_server::AppendFrame(response,
+                                connections[request.connection].out);
+    }
+
+    for (auto &connection : connections) {
+      // a client that stopped sending may still read its responses
+      if (!connection.out.empty())
+        Flush(connection);
+      if (connection.closed)
+        close(connection.fd);
+    }
+    std::erase_if(connections, [](const Connection &connection) {
+      return connection.closed;
+    });
+  }
+}
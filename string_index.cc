@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "string_index.h"
+
+namespace {
+// assigns the sorted positions [0, count) to Eytzinger positions [1, count]
+void Layout(std::vector<uint32_t> &order, uint32_t &next, uint32_t k) {
+  if (k >= order.size())
+    return;
+  Layout(order, next, 2 * k);
+  order[k] = next++;
+  Layout(order, next, 2 * k + 1);
+}
+
+// the UTF-16 code unit at p, bounded by end
+uint32_t DecodeUnit(const uint8_t *p, const uint8_t *end) {
+  uint32_t one = *p++;
+  if (!(one & 0x80) || p == end)
+    return one;
+  uint32_t two = *p++ & 0x3f;
+  if (!(one & 0x20))
+    return (one & 0x1f) << 6 | two;
+  uint32_t three = p == end ? 0 : *p & 0x3f;
+  return (one & 0x0f) << 12 | two << 6 | three;
+}
+
+bool HasByte(uint64_t word, uint8_t byte) {
+  constexpr uint64_t kOnes = 0x0101010101010101;
+  word ^= kOnes * byte;
+  return (word - kOnes) & ~word & (kOnes << 7);
+}
+} // namespace
+
+int StringIndex::Compare(std::string_view a, std::string_view b) {
+  auto *pa = reinterpret_cast<const uint8_t *>(a.data());
+  auto *pb = reinterpret_cast<const uint8_t *>(b.data());
+  size_t size = std::min(a.size(), b.size());
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t wa, wb;
+    std::memcpy(&wa, pa + i, 8);
+    std::memcpy(&wb, pb + i, 8);
+    if (wa != wb) {
+      if constexpr (std::endian::native == std::endian::little)
+        i += __builtin_ctzll(wa ^ wb) / 8;
+      break;
+    }
+  }
+  while (i < size && pa[i] == pb[i])
+    ++i;
+  if (i == size)
+    return a.size() < b.size() ? -1 : a.size() > b.size();
+  if (!((pa[i] | pb[i]) & 0x80))
+    return int(pa[i]) - int(pb[i]);
+  // back to the start of the character both strings share up to i
+  while (i > 0 && (pa[i] & 0xc0) == 0x80 && (pb[i] & 0xc0) == 0x80)
+    --i;
+  return int(DecodeUnit(pa + i, pa + a.size())) -
+         int(DecodeUnit(pb + i, pb + b.size()));
+}
+
+StringIndex::StringIndex(const std::vector<std::string_view> &strings) {
+  if (strings.empty())
+    return;
+  Build(strings, 0, strings.size(), 0);
+  nodes_.shrink_to_fit();
+  keys_.shrink_to_fit();
+  groups_.shrink_to_fit();
+}
+
+uint64_t StringIndex::Chunk(std::string_view str, size_t depth) {
+  size_t offset = depth * 8;
+  uint64_t key = 0;
+  if constexpr (std::endian::native == std::endian::little) {
+    if (str.size() >= offset + 8) {
+      std::memcpy(&key, str.data() + offset, 8);
+      if (!HasByte(key, 0xc0))
+        return __builtin_bswap64(key);
+      key = 0;
+    }
+  }
+  for (size_t i = offset; i < offset + 8; ++i) {
+    key <<= 8;
+    if (i < str.size() && uint8_t(str[i]) != 0xc0)
+      key |= uint8_t(str[i]);
+  }
+  return key;
+}
+
+uint32_t StringIndex::Build(const std::vector<std::string_view> &strings,
+                            uint32_t begin, uint32_t end, size_t depth) {
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> starts;
+  for (auto i = begin; i < end; ++i) {
+    auto key = Chunk(strings[i], depth);
+    if (keys.empty() || keys.back() != key) {
+      keys.emplace_back(key);
+      starts.emplace_back(i);
+    }
+  }
+  starts.emplace_back(end);
+
+  uint32_t node = nodes_.size();
+  uint32_t first = keys_.size();
+  uint32_t count = keys.size();
+  nodes_.push_back({.first = first, .count = count, .end = end});
+  keys_.resize(first + count);
+  groups_.resize(first + count);
+  std::vector<uint32_t> order(count + 1);
+  uint32_t next = 0;
+  Layout(order, next, 1);
+  for (uint32_t k = 1; k <= count; ++k) {
+    auto g = order[k];
+    keys_[first + k - 1] = keys[g];
+    groups_[first + k - 1] = {.start = starts[g], .child = kLeaf};
+  }
+  for (uint32_t k = 1; k <= count; ++k) {
+    auto g = order[k];
+    if (starts[g + 1] - starts[g] > 1) {
+      auto child = Build(strings, starts[g], starts[g + 1], depth + 1);
+      groups_[first + k - 1].child = child;
+    }
+  }
+  return node;
+}
+
+template <StringIndex::Mode kMode>
+uint32_t StringIndex::Search(const std::vector<std::string_view> &strings,
+                             std::string_view str) const {
+  auto less = [](std::string_view a, std::string_view b) {
+    return Compare(a, b) < 0;
+  };
+  // whether other is before the end of the search
+  auto before = [&str, &less](std::string_view other) {
+    if constexpr (kMode == kLowerBound)
+      return less(other, str);
+    else if constexpr (kMode == kUpperBound)
+      return !less(str, other);
+    else
+      return other.substr(0, str.size()) == str || less(other, str);
+  };
+  if (nodes_.empty())
+    return 0;
+  if (str.find('\0') != str.npos) {
+    // a raw NUL is not MUTF-8 and breaks the zero padding of the chunks
+    return std::partition_point(strings.begin(), strings.end(), before) -
+           strings.begin();
+  }
+  uint32_t node_idx = 0;
+  for (size_t depth = 0;; ++depth) {
+    auto &node = nodes_[node_idx];
+    const uint64_t *keys = keys_.data() + node.first - 1;
+    uint64_t key = Chunk(str, depth);
+    bool ends = str.size() <= depth * 8 + 8;
+    if (kMode == kPrefixEnd && ends && str.size() < depth * 8 + 8) {
+      // past every chunk starting with the rest of the prefix
+      key |= ~uint64_t(0) >> (str.size() - depth * 8) * 8;
+    }
+    uint32_t k = 1;
+    while (k <= node.count) {
+      // the node 3 levels down: its 8 keys share one cache line
+      if (8 * k <= node.count)
+        __builtin_prefetch(keys + 8 * k);
+      k = 2 * k + (kMode == kPrefixEnd && ends ? keys[k] <= key
+                                               : keys[k] < key);
+    }
+    // drop the trailing right turns and the left turn above them
+    k >>= __builtin_ffs(~k);
+    if (k == 0)
+      return node.end;
+    auto &group = groups_[node.first + k - 1];
+    if (keys[k] != key || (kMode == kPrefixEnd && ends))
+      return group.start;
+    if (group.child == kLeaf)
+      return group.start + before(strings[group.start]);
+    if (ends) {
+      // str ends in this chunk: it is a prefix of the group's strings, and
+      // equal to the first one at most
+      return group.start +
+             (kMode == kUpperBound &&
+              strings[group.start].size() == str.size());
+    }
+    node_idx = group.child;
+  }
+}
+
+template uint32_t StringIndex::Search<StringIndex::kLowerBound>(
+    const std::vector<std::string_view> &strings, std::string_view str) const;
+template uint32_t StringIndex::Search<StringIndex::kUpperBound>(
+    const std::vector<std::string_view> &strings, std::string_view str) const;
+template uint32_t StringIndex::Search<StringIndex::kPrefixEnd>(
+    const std::vector<std::string_view> &strings, std::string_view str) const;
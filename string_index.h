@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Search structure over a dex string table, a trie over 8-byte chunks.
+// A node holds the distinct chunks at one depth of a range of strings
+// sharing their previous chunks, as big-endian integers in Eytzinger
+// (breadth-first tree) order. A search walks these compact arrays and
+// touches string data at most once, at the end, so class descriptors
+// sharing long prefixes like "Landroid/" cost a few more nodes instead of
+// string comparisons.
+//
+// Strings are MUTF-8 and order by UTF-16 code units, as in the string
+// pool (see Compare). The table itself is not kept: pass the same strings
+// to every search.
+class StringIndex {
+public:
+  StringIndex() = default;
+  explicit StringIndex(const std::vector<std::string_view> &strings);
+
+  // position of the first string not less than str, strings.size() if none
+  uint32_t LowerBound(const std::vector<std::string_view> &strings,
+                      std::string_view str) const {
+    return Search<kLowerBound>(strings, str);
+  }
+  // position of the first string greater than str, strings.size() if none
+  uint32_t UpperBound(const std::vector<std::string_view> &strings,
+                      std::string_view str) const {
+    return Search<kUpperBound>(strings, str);
+  }
+  // end of the strings starting with prefix, which begin at
+  // LowerBound(prefix)
+  uint32_t PrefixEnd(const std::vector<std::string_view> &strings,
+                     std::string_view prefix) const {
+    return Search<kPrefixEnd>(strings, prefix);
+  }
+  // position of str, uint32_t(-1) if missing
+  uint32_t Find(const std::vector<std::string_view> &strings,
+                std::string_view str) const {
+    auto pos = LowerBound(strings, str);
+    return pos < strings.size() && strings[pos] == str ? pos : uint32_t(-1);
+  }
+  size_t bytes() const {
+    return nodes_.capacity() * sizeof(Node) +
+           keys_.capacity() * sizeof(uint64_t) +
+           groups_.capacity() * sizeof(Group);
+  }
+
+  // <0, 0 or >0 as a sorts before, with or after b in UTF-16 code unit
+  // order. This is bytewise order except for U+0000, encoded as C0 80, so
+  // bytes are compared until they differ and only a non-ASCII difference
+  // is decoded.
+  static int Compare(std::string_view a, std::string_view b);
+
+private:
+  enum Mode { kLowerBound, kUpperBound, kPrefixEnd };
+  static constexpr uint32_t kLeaf = uint32_t(-1);
+
+  struct Node {
+    // entries [first, first + count) of keys and groups
+    uint32_t first;
+    uint32_t count;
+    // positions of the strings below the node
+    uint32_t end;
+  };
+  // the strings of a node sharing one chunk
+  struct Group {
+    uint32_t start;
+    // node of the next chunk, kLeaf for a single string
+    uint32_t child;
+  };
+
+  // bytes [8 * depth, 8 * depth + 8) of str, zero padded, big-endian, with
+  // the C0 of an encoded U+0000 as 00 to keep the order
+  static uint64_t Chunk(std::string_view str, size_t depth);
+  uint32_t Build(const std::vector<std::string_view> &strings, uint32_t begin,
+                 uint32_t end, size_t depth);
+  template <Mode kMode>
+  uint32_t Search(const std::vector<std::string_view> &strings,
+                  std::string_view str) const;
+
+  // nodes[0] is the root
+  std::vector<Node> nodes_;
+  std::vector<uint64_t> keys_;
+  std::vector<Group> groups_;
+};
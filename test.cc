@@ -0,0 +1,966 @@
+#include "apk_loader.h"
+#include "dex_generator.h"
+#include "dex_helper.h"
+#include "dex_helper_pool.h"
+#include "index_file.h"
+#include "posting_list.h"
+#include "roaring_set.h"
+#include "string_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+// Regression tests. Brute force references, or a DexHelper queried cold,
+// stand in for the optimized paths; run them under
+// -fsanitize=address,undefined as well.
+//
+// usage: test
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,         \
+              #condition);                                                     \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+// UTF-16 code units of a MUTF-8 string, decoded independently of
+// StringIndex::Compare
+std::u16string Utf16(std::string_view str) {
+  std::u16string out;
+  for (size_t i = 0; i < str.size();) {
+    auto byte = uint8_t(str[i]);
+    if (byte < 0x80) {
+      out += char16_t(byte);
+      i += 1;
+    } else if ((byte & 0xe0) == 0xc0) {
+      out += char16_t((byte & 0x1f) << 6 | (str[i + 1] & 0x3f));
+      i += 2;
+    } else {
+      out += char16_t((byte & 0x0f) << 12 | (str[i + 1] & 0x3f) << 6 |
+                      (str[i + 2] & 0x3f));
+      i += 3;
+    }
+  }
+  return out;
+}
+
+bool Less(std::string_view a, std::string_view b) {
+  return Utf16(a) < Utf16(b);
+}
+
+int Sign(int value) { return (value > 0) - (value < 0); }
+
+// Characters the pool strings are made of: ASCII, the C0 80 of U+0000,
+// two and three byte sequences and a surrogate pair, which MUTF-8 encodes
+// as two three byte sequences and UTF-16 orders below U+FFFF.
+const char *const kCharacters[] = {
+    "a",      "b",        "/",        "\x01",         "\x7f",
+    "\xc0\x80", "\xc3\xa9", "\xdf\xbf", "\xe2\x82\xac", "\xef\xbf\xbf",
+    "\xed\xa0\xbd\xed\xb8\x80"};
+// shared prefixes, so that the trie has nodes below its root
+const char *const kPrefixes[] = {"", "", "Lcom/example/", "Lcom/example/a",
+                                 "Landroid/\xc3\xa9"};
+
+std::string RandomString(std::mt19937 &rng) {
+  std::string str = kPrefixes[rng() % std::size(kPrefixes)];
+  for (size_t length = rng() % 12; length > 0; --length)
+    str += kCharacters[rng() % std::size(kCharacters)];
+  return str;
+}
+
+// offsets of the character boundaries of str, 0 and str.size() included
+std::vector<size_t> Boundaries(std::string_view str) {
+  std::vector<size_t> boundaries = {0};
+  for (size_t at = 1; at <= str.size(); ++at) {
+    if (at == str.size() || (str[at] & 0xc0) != 0x80)
+      boundaries.emplace_back(at);
+  }
+  return boundaries;
+}
+
+void TestStringIndex() {
+  std::mt19937 rng(40);
+  for (size_t size : {0, 1, 2, 9, 100, 3000}) {
+    std::vector<std::string> pool;
+    while (pool.size() < size)
+      pool.emplace_back(RandomString(rng));
+    std::sort(pool.begin(), pool.end(), Less);
+    pool.erase(std::unique(pool.begin(), pool.end()), pool.end());
+    std::vector<std::string_view> strings(pool.begin(), pool.end());
+    StringIndex index(strings);
+
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < 2000; ++i) {
+      auto str = !pool.empty() && rng() % 2 ? pool[rng() % pool.size()]
+                                            : RandomString(rng);
+      // prefixes cut at a character boundary
+      auto boundaries = Boundaries(str);
+      auto cut = boundaries[rng() % boundaries.size()];
+      queries.emplace_back(str.substr(0, cut));
+    }
+    // the prefix range of the last strings ends at the end of the pool
+    if (!pool.empty() && !pool.back().empty())
+      queries.emplace_back(pool.back().substr(0, Boundaries(pool.back())[1]));
+
+    for (auto &query : queries) {
+      auto lower = std::lower_bound(strings.begin(), strings.end(),
+                                    std::string_view(query), Less) -
+                   strings.begin();
+      auto upper = std::upper_bound(strings.begin(), strings.end(),
+                                    std::string_view(query), Less) -
+                   strings.begin();
+      auto prefix_end = lower;
+      while (prefix_end < ssize_t(strings.size()) &&
+             strings[prefix_end].starts_with(query))
+        ++prefix_end;
+      CHECK(index.LowerBound(strings, query) == lower);
+      CHECK(index.UpperBound(strings, query) == upper);
+      CHECK(index.PrefixEnd(strings, query) == prefix_end);
+      CHECK(index.Find(strings, query) ==
+            (lower < upper ? uint32_t(lower) : uint32_t(-1)));
+      if (!pool.empty()) {
+        auto &other = pool[rng() % pool.size()];
+        CHECK(Sign(StringIndex::Compare(query, other)) ==
+              Less(other, query) - Less(query, other));
+      }
+    }
+  }
+}
+
+void TestFrozenPostings() {
+  std::mt19937 rng(36);
+  // sorted lists as the caches keep them, and deltas of either sign up to
+  // the full uint32_t range
+  std::vector<std::vector<uint32_t>> lists = {
+      {}, {7}, {3, 1, 200000}, {0, 0x7fffffff, 0xffffffff, 0}};
+  for (size_t i = 0; i < 200; ++i) {
+    std::vector<uint32_t> list;
+    for (size_t length = rng() % 20; length > 0; --length)
+      list.emplace_back(rng() % (i < 100 ? 300 : 0x10000000));
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+    lists.emplace_back(std::move(list));
+  }
+  lists.emplace_back();
+
+  FrozenPostings frozen(lists);
+  CHECK(frozen.size() == lists.size());
+  for (size_t i = 0; i < lists.size() && i < frozen.size(); ++i) {
+    auto packed = frozen[i];
+    std::vector<uint32_t> list(packed.begin(), packed.end());
+    CHECK(list == lists[i]);
+    CHECK(packed.size() == lists[i].size());
+    CHECK(packed.empty() == lists[i].empty());
+    if (!lists[i].empty())
+      CHECK(packed.front() == lists[i].front());
+  }
+  CHECK(FrozenPostings(std::vector<std::vector<uint32_t>>{}).size() == 0);
+}
+
+// streams read from a mapping are viewed in place after validation
+void TestPostingsView() {
+  std::vector<std::vector<uint32_t>> lists = {
+      {3, 1, 200000}, {}, {7}, {0, 0x7fffffff}};
+  FrozenPostings frozen(lists);
+  std::vector<uint32_t> offsets(frozen.offsets().begin(),
+                                frozen.offsets().end());
+  std::vector<uint8_t> data(frozen.data().begin(), frozen.data().end());
+
+  FrozenPostings view;
+  CHECK(view.View(offsets, data, lists.size(), 0x80000000));
+  CHECK(view.size() == lists.size());
+  for (size_t i = 0; i < lists.size() && i < view.size(); ++i) {
+    std::vector<uint32_t> list(view[i].begin(), view[i].end());
+    CHECK(list == lists[i]);
+  }
+
+  // a malformed stream is rejected and leaves the view empty
+  auto rejects = [&view](const std::vector<uint32_t> &offsets,
+                         const std::vector<uint8_t> &data, size_t lists,
+                         uint32_t id_limit) {
+    view = FrozenPostings(std::vector<std::vector<uint32_t>>{{1}});
+    return !view.View(offsets, data, lists, id_limit) && view.empty();
+  };
+  CHECK(rejects(offsets, data, lists.size() + 1, 0x80000000));
+  CHECK(rejects(offsets, data, lists.size(), 0x7fffffff));
+  CHECK(rejects(offsets, {data.begin(), data.end() - 1}, lists.size(),
+                0x80000000));
+  auto swapped = offsets;
+  std::swap(swapped[0], swapped[1]);
+  CHECK(rejects(swapped, data, lists.size(), 0x80000000));
+  // the first list ends inside a varint
+  auto inside = data;
+  inside[offsets[1] - 1] |= 0x80;
+  CHECK(rejects(offsets, inside, lists.size(), 0x80000000));
+  // a varint longer than any uint32_t takes
+  CHECK(rejects({0, 6}, {0x80, 0x80, 0x80, 0x80, 0x80, 0x01}, 1, 100));
+  CHECK(rejects({0}, {}, 1, 100));
+  CHECK(rejects({}, {}, 0, 100));
+  CHECK(view.View(std::vector<uint32_t>{0, 0}, {}, 1, 0));
+}
+
+void TestIndexFile() {
+  dex::Header header{};
+  for (size_t i = 0; i < sizeof(header.signature); ++i)
+    header.signature[i] = i;
+  dex::Header other = header;
+  other.signature[0] ^= 1;
+
+  std::vector<std::vector<uint32_t>> lists = {{1, 2}, {}, {5}};
+  FrozenPostings frozen(lists);
+  std::vector<index_file::Table> shapes = {{.lists = 3, .id_limit = 6},
+                                           {.lists = 3, .id_limit = 6}};
+  std::vector<uint8_t> sections;
+  index_file::Encode(sections, other, {&frozen, &frozen});
+  index_file::Encode(sections, header, {&frozen, &frozen});
+
+  char dir[] = "/tmp/dexhelper-test-XXXXXX";
+  CHECK(mkdtemp(dir));
+  auto path = index_file::Path(dir, header);
+  // reads back sections written to path
+  auto find = [&](const std::vector<uint8_t> &sections,
+                  const std::vector<index_file::Table> &shapes) {
+    std::vector<FrozenPostings> tables;
+    if (!index_file::Write(path, sections))
+      return false;
+    auto found = index_file::Open(path).Find(header, shapes, tables);
+    CHECK(found == (tables.size() == shapes.size()));
+    return found;
+  };
+
+  CHECK(find(sections, shapes));
+  std::vector<FrozenPostings> tables;
+  auto mapping = index_file::Open(path);
+  CHECK(mapping.Find(header, shapes, tables));
+  for (size_t i = 0; i < lists.size() && tables.size() == 2; ++i) {
+    std::vector<uint32_t> list(tables[1][i].begin(), tables[1][i].end());
+    CHECK(list == lists[i]);
+  }
+
+  CHECK(!find(sections, {{.lists = 2, .id_limit = 6}}));
+  CHECK(!find(sections, {{.lists = 3, .id_limit = 5}, shapes[1]}));
+  CHECK(!find(sections, {shapes[0], shapes[1], shapes[1]}));
+  // every truncation cuts the section of header
+  for (size_t size = 0; size < sections.size(); ++size)
+    CHECK(!find({sections.begin(), sections.begin() + size}, shapes));
+  // a section size that is not a multiple of 4, past the end, or smaller
+  // than a section header, and a bad magic
+  struct {
+    size_t offset;
+    uint8_t value;
+  } corruptions[] = {{28, 1}, {29, 0xff}, {28, 0}, {0, 'x'}};
+  for (auto [offset, value] : corruptions) {
+    auto corrupt = sections;
+    corrupt[offset] = value;
+    CHECK(!find(corrupt, shapes));
+  }
+
+  CHECK(index_file::Open(path + ".missing").empty());
+  CHECK(!index_file::Write(std::string(dir) + "/missing/x.idx", sections));
+  unlink(path.c_str());
+  CHECK(rmdir(dir) == 0);
+
+  int fd = index_file::Share(sections);
+  CHECK(fd != -1);
+  CHECK(index_file::MapShared(fd).Find(header, shapes, tables));
+  close(fd);
+  // a memfd nobody sealed could still change under the mapping
+  fd = memfd_create("dexhelper-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  CHECK(write(fd, sections.data(), sections.size()) ==
+        ssize_t(sections.size()));
+  CHECK(index_file::MapShared(fd).empty());
+  close(fd);
+}
+
+// sorted, duplicate free copy of ids
+std::vector<uint32_t> Sorted(std::vector<uint32_t> ids) {
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return ids;
+}
+
+void TestRoaringSet() {
+  std::mt19937 rng(37);
+  // ids in a few containers, sparse enough for an array or dense enough for
+  // a bitmap, so that the results cross between them
+  auto random_ids = [&rng] {
+    std::vector<uint32_t> ids;
+    for (uint32_t key = 0; key < 4; ++key) {
+      size_t counts[] = {0, 10, 3000, 5000, 30000};
+      for (size_t count = counts[rng() % std::size(counts)]; count > 0;
+           --count)
+        ids.emplace_back(key << 16 | (rng() % 40000));
+    }
+    return ids;
+  };
+  for (size_t i = 0; i < 30; ++i) {
+    auto a_ids = random_ids(), b_ids = random_ids();
+    RoaringSet a(a_ids), b;
+    for (auto id : b_ids)
+      b.Add(id);
+    auto a_sorted = Sorted(a_ids), b_sorted = Sorted(b_ids);
+    CHECK(a.ToVector() == a_sorted);
+    CHECK(b.ToVector() == b_sorted);
+    CHECK(a.size() == a_sorted.size());
+    CHECK(a.empty() == a_sorted.empty());
+
+    std::vector<uint32_t> both, either, only_a, walked;
+    std::set_intersection(a_sorted.begin(), a_sorted.end(), b_sorted.begin(),
+                          b_sorted.end(), std::back_inserter(both));
+    std::set_union(a_sorted.begin(), a_sorted.end(), b_sorted.begin(),
+                   b_sorted.end(), std::back_inserter(either));
+    std::set_difference(a_sorted.begin(), a_sorted.end(), b_sorted.begin(),
+                        b_sorted.end(), std::back_inserter(only_a));
+    CHECK((a & b).ToVector() == both);
+    CHECK((a | b).ToVector() == either);
+    CHECK((a - b).ToVector() == only_a);
+    CHECK((a & b) == RoaringSet(both));
+    CHECK((a - a).empty());
+    (a | b).ForEach([&walked](uint32_t id) { walked.emplace_back(id); });
+    CHECK(walked == either);
+    for (size_t j = 0; j < 100; ++j) {
+      uint32_t id = rng() % 4 << 16 | (rng() % 40000);
+      CHECK(a.Contains(id) ==
+            std::binary_search(a_sorted.begin(), a_sorted.end(), id));
+    }
+  }
+}
+
+using DexList = std::vector<std::tuple<const void *, size_t>>;
+
+const SyntheticDexOptions kDexOptions = {
+    .dex_count = 3, .class_count = 300, .string_count = 400};
+
+// the dexes the DexHelper tests query, generated once
+const DexList &Dexes() {
+  static const auto images = GenerateSyntheticDexes(kDexOptions);
+  static const auto dexs = [] {
+    DexList dexs;
+    for (auto &image : images)
+      dexs.emplace_back(image.data(), image.size());
+    return dexs;
+  }();
+  return dexs;
+}
+
+// the methods as names, which unlike indices compare across helpers
+std::vector<std::string> Names(const DexHelper &helper,
+                               const std::vector<size_t> &methods) {
+  std::vector<std::string> names;
+  for (auto method_idx : methods) {
+    auto method = helper.DecodeMethod(method_idx);
+    names.emplace_back(std::string(method.declaring_class.name) + "->" +
+                       std::string(method.name));
+  }
+  return names;
+}
+
+// A query of kind on helper, with no filters. Kinds 0-2 search a literal,
+// callers of a method and getters of a field picked by target.
+std::vector<size_t> Query(const DexHelper &helper, int kind, size_t target,
+                          bool find_first,
+                          DexHelper::QueryStats *stats = nullptr) {
+  auto class_name = SyntheticClassName(target % kDexOptions.class_count);
+  switch (kind) {
+  case 0:
+    return helper.FindMethodUsingString(SyntheticLiteral(target, kDexOptions),
+                                        false, -1, -1, "", -1, {}, {}, {},
+                                        find_first, stats);
+  case 1:
+    return helper.FindMethodInvoked(
+        helper.CreateMethodIndex(class_name, "m1", {}), -1, -1, "", -1, {}, {},
+        {}, find_first, stats);
+  default:
+    return helper.FindMethodGettingField(
+        helper.CreateFieldIndex(class_name, "f0"), -1, -1, "", -1, {}, {}, {},
+        find_first, stats);
+  }
+}
+
+// A helper answers the same whether the methods it needs were scanned by
+// the query itself, by CreateFullCache or by earlier queries in any order.
+void TestColdAndWarm() {
+  for (bool compress : {false, true}) {
+    DexHelper::Options options{.compress_postings = compress};
+    DexHelper warm(Dexes(), options), partly_warm(Dexes(), options);
+    warm.CreateFullCache();
+    std::mt19937 rng(38);
+    for (size_t i = 0; i < 200; ++i) {
+      // scans single methods anywhere in code order
+      for (auto name : {"m0", "m1", "m2"}) {
+        partly_warm.FindMethodInvoking(
+            partly_warm.CreateMethodIndex(
+                SyntheticClassName(rng() % kDexOptions.class_count), name, {}),
+            -1, -1, "", -1, {}, {}, {}, false);
+      }
+      int kind = rng() % 3;
+      size_t target = rng() % kDexOptions.string_count;
+      bool find_first = rng() % 2;
+      DexHelper cold(Dexes(), options);
+      auto expected = Names(cold, Query(cold, kind, target, find_first));
+      CHECK(Names(warm, Query(warm, kind, target, find_first)) == expected);
+      CHECK(Names(partly_warm, Query(partly_warm, kind, target,
+                                     find_first)) == expected);
+    }
+  }
+}
+
+// The index files a full scan writes answer a later helper without it
+// scanning any code, with the results of a cold helper.
+void TestIndexDir() {
+  char dir[] = "/tmp/dexhelper-test-XXXXXX";
+  CHECK(mkdtemp(dir));
+  DexHelper::Options options{.index_dir = dir};
+  DexHelper(Dexes(), options).CreateFullCache();
+  DexHelper loaded(Dexes(), options), cold(Dexes());
+  std::mt19937 rng(44);
+  for (size_t i = 0; i < 100; ++i) {
+    int kind = rng() % 3;
+    size_t target = rng() % kDexOptions.string_count;
+    bool find_first = rng() % 2;
+    DexHelper::QueryStats stats;
+    auto found = Query(loaded, kind, target, find_first, &stats);
+    CHECK(stats.methods_scanned == 0);
+    CHECK(Names(loaded, found) ==
+          Names(cold, Query(cold, kind, target, find_first)));
+  }
+  for (auto &dex : Dexes()) {
+    auto *header = static_cast<const dex::Header *>(std::get<0>(dex));
+    CHECK(unlink(index_file::Path(dir, *header).c_str()) == 0);
+  }
+  CHECK(rmdir(dir) == 0);
+}
+
+// The caches another process exported answer a helper mapping them without
+// it scanning any code.
+void TestSharedIndex() {
+  int fd = DexHelper(Dexes()).ExportIndex();
+  CHECK(fd != -1);
+  DexHelper shared(Dexes(), {.shared_index = fd}), cold(Dexes());
+  close(fd);
+  std::mt19937 rng(45);
+  for (size_t i = 0; i < 100; ++i) {
+    int kind = rng() % 3;
+    size_t target = rng() % kDexOptions.string_count;
+    bool find_first = rng() % 2;
+    DexHelper::QueryStats stats;
+    auto found = Query(shared, kind, target, find_first, &stats);
+    CHECK(stats.methods_scanned == 0);
+    CHECK(Names(shared, found) ==
+          Names(cold, Query(cold, kind, target, find_first)));
+  }
+}
+
+// A lazy helper answers as an eager one, and a query confined to a dex by
+// its dex_priority prepares no other dex, although the method indices of
+// its results name methods other dexes define or call.
+void TestLazyInit() {
+  DexHelper eager(Dexes());
+  for (size_t dex_idx = 0; dex_idx < Dexes().size(); ++dex_idx) {
+    DexHelper lazy(Dexes(), {.lazy_init = true});
+    auto literal = SyntheticLiteral(dex_idx, kDexOptions);
+    auto found = lazy.FindMethodUsingString(literal, false, -1, -1, "", -1, {},
+                                            {}, {dex_idx}, false);
+    CHECK(!found.empty());
+    CHECK(Names(lazy, found) ==
+          Names(eager, eager.FindMethodUsingString(literal, false, -1, -1, "",
+                                                   -1, {}, {}, {dex_idx},
+                                                   false)));
+    auto per_dex = lazy.MemoryStats().per_dex;
+    for (size_t other = 0; other < per_dex.size(); ++other) {
+      size_t used = 0;
+      for (auto &table : per_dex[other])
+        used += table.used;
+      CHECK((used != 0) == (other == dex_idx));
+    }
+  }
+
+  DexHelper lazy(Dexes(), {.lazy_init = true});
+  std::mt19937 rng(42);
+  for (size_t i = 0; i < 100; ++i) {
+    int kind = rng() % 3;
+    size_t target = rng() % kDexOptions.string_count;
+    bool find_first = rng() % 2;
+    CHECK(Names(lazy, Query(lazy, kind, target, find_first)) ==
+          Names(eager, Query(eager, kind, target, find_first)));
+    auto class_name = SyntheticClassName(target % kDexOptions.class_count);
+    auto fields = [&](const DexHelper &helper) {
+      std::vector<std::string> names;
+      for (auto field_idx : helper.FindField(
+               helper.CreateClassIndex(class_name), {}, find_first)) {
+        auto field = helper.DecodeField(field_idx);
+        names.emplace_back(std::string(field.declaring_class.name) + "->" +
+                           std::string(field.name));
+      }
+      return names;
+    };
+    CHECK(fields(lazy) == fields(eager));
+  }
+}
+
+// A helper given a dex later answers as one built with it, and keeps the
+// indices it created before. Once the dex is removed it answers as one
+// built without it.
+void TestAddAndRemoveDex() {
+  auto &dexs = Dexes();
+  DexList without_last(dexs.begin(), dexs.end() - 1);
+  DexList without_middle = {dexs.front(), dexs.back()};
+  for (bool lazy : {false, true}) {
+    DexHelper::Options options{.lazy_init = lazy};
+    DexHelper helper(without_last, options), all(dexs, options);
+    DexHelper middle_removed(without_middle, options);
+    std::vector<size_t> before;
+    for (size_t i = 0; i < 20; ++i) {
+      auto class_name = SyntheticClassName(i * 13);
+      before.emplace_back(helper.CreateClassIndex(class_name));
+      helper.FindMethodInvoked(helper.CreateMethodIndex(class_name, "m1", {}),
+                               -1, -1, "", -1, {}, {}, {}, false);
+    }
+    CHECK(helper.AddDex(std::get<0>(dexs.back()), std::get<1>(dexs.back())) ==
+          dexs.size() - 1);
+    for (size_t i = 0; i < before.size(); ++i) {
+      // a class no dex had yet got an index that decodes to nothing
+      auto class_name = SyntheticClassName(i * 13);
+      CHECK((helper.CreateClassIndex(class_name) == before[i]) ==
+            (helper.DecodeClass(before[i]).name == class_name));
+    }
+
+    std::mt19937 rng(43);
+    auto compare = [&](const DexHelper &expected) {
+      for (size_t i = 0; i < 50; ++i) {
+        int kind = rng() % 3;
+        size_t target = rng() % kDexOptions.string_count;
+        bool find_first = rng() % 2;
+        CHECK(Names(helper, Query(helper, kind, target, false)) ==
+              Names(expected, Query(expected, kind, target, false)));
+        // find_first returns a method of the first dex having one
+        CHECK(Query(helper, kind, target, find_first).size() ==
+              Query(expected, kind, target, find_first).size());
+      }
+    };
+    compare(all);
+
+    helper.RemoveDex(1);
+    compare(middle_removed);
+    for (size_t target = 0; target < 20; ++target) {
+      CHECK(helper
+                .FindMethodUsingString(SyntheticLiteral(target, kDexOptions),
+                                       false, -1, -1, "", -1, {}, {}, {1},
+                                       false)
+                .empty());
+    }
+  }
+}
+
+// A helper recording only some relations answers every query as one
+// recording all of them, and leaves the caches of the others empty until
+// a query needs them.
+void TestRelations() {
+  DexHelper all(Dexes());
+  for (unsigned relations :
+       {0u, unsigned(DexHelper::kStringRelation),
+        unsigned(DexHelper::kInvokedRelation | DexHelper::kGettingRelation)}) {
+    DexHelper helper(Dexes(), {.relations = relations});
+    auto cache_used = [&helper](const char *name) {
+      for (auto &table : helper.MemoryStats().tables) {
+        if (std::string_view(table.name) == name)
+          return table.used;
+      }
+      return size_t(0);
+    };
+    std::mt19937 rng(48);
+    for (size_t i = 0; i < 100; ++i) {
+      size_t target = rng() % kDexOptions.string_count;
+      bool find_first = rng() % 2;
+      CHECK(Names(helper, Query(helper, 0, target, find_first)) ==
+            Names(all, Query(all, 0, target, find_first)));
+    }
+    // the relation a query searches is recorded whatever the profile
+    CHECK(cache_used("string_cache") != 0);
+    CHECK((cache_used("invoked_cache") != 0) ==
+          bool(relations & DexHelper::kInvokedRelation));
+    CHECK(cache_used("setting_cache") == 0);
+    for (size_t i = 0; i < 100; ++i) {
+      int kind = rng() % 3;
+      size_t target = rng() % kDexOptions.string_count;
+      bool find_first = rng() % 2;
+      CHECK(Names(helper, Query(helper, kind, target, find_first)) ==
+            Names(all, Query(all, kind, target, find_first)));
+    }
+  }
+}
+
+// Under a memory budget the caches of the least recently searched dexes go
+// first, and the results stay those of an unlimited helper.
+void TestMemoryBudget() {
+  auto search = [](const DexHelper &helper, size_t dex_idx) {
+    return helper.FindMethodUsingString(SyntheticLiteral(dex_idx, kDexOptions),
+                                        false, -1, -1, "", -1, {}, {},
+                                        {dex_idx}, false);
+  };
+  // room for the caches one search fills, not for two
+  size_t budget = 0;
+  for (size_t dex_idx = 0; dex_idx < Dexes().size(); ++dex_idx) {
+    DexHelper one(Dexes());
+    search(one, dex_idx);
+    budget = std::max(budget, one.CacheBytes() * 3 / 2);
+  }
+
+  DexHelper unlimited(Dexes()), helper(Dexes(), {.memory_budget = budget});
+  for (size_t dex_idx = 0; dex_idx < Dexes().size(); ++dex_idx) {
+    search(helper, dex_idx);
+    CHECK(helper.CacheBytes() <= budget);
+  }
+  CHECK(helper.GetEvictionStats().evictions == Dexes().size() - 1);
+  auto per_dex = helper.MemoryStats().per_dex;
+  for (size_t dex_idx = 0; dex_idx < per_dex.size(); ++dex_idx) {
+    for (auto &table : per_dex[dex_idx]) {
+      if (std::string_view(table.name) == "string_cache")
+        CHECK((table.used != 0) == (dex_idx + 1 == per_dex.size()));
+    }
+  }
+
+  std::mt19937 rng(29);
+  for (size_t i = 0; i < 100; ++i) {
+    int kind = rng() % 3;
+    size_t target = rng() % kDexOptions.string_count;
+    bool find_first = rng() % 2;
+    CHECK(Names(helper, Query(helper, kind, target, find_first)) ==
+          Names(unlimited, Query(unlimited, kind, target, find_first)));
+    CHECK(helper.CacheBytes() <= budget);
+  }
+  CHECK(helper.GetEvictionStats().rescans != 0);
+}
+
+// The set queries hold the methods the Find* queries return, and filtering
+// by intersecting with FindMethodSetMatching equals filtering in the query.
+void TestMethodSets() {
+  DexHelper helper(Dexes());
+  auto indices = [&helper](const DexHelper::MethodSet &set) {
+    return helper.MethodIndices(set);
+  };
+  auto sorted = [](std::vector<size_t> methods) {
+    std::sort(methods.begin(), methods.end());
+    methods.erase(std::unique(methods.begin(), methods.end()), methods.end());
+    return methods;
+  };
+  std::mt19937 rng(37);
+  for (size_t i = 0; i < 50; ++i) {
+    size_t target = rng() % kDexOptions.string_count;
+    auto literal = SyntheticLiteral(target, kDexOptions);
+    auto class_name = SyntheticClassName(target % kDexOptions.class_count);
+    auto class_idx = helper.CreateClassIndex(class_name);
+    auto method_idx = helper.CreateMethodIndex(class_name, "m1", {});
+    auto field_idx = helper.CreateFieldIndex(class_name, "f0");
+
+    auto using_string = helper.FindMethodSetUsingString(literal, false);
+    CHECK(indices(using_string) ==
+          sorted(helper.FindMethodUsingString(literal, false, -1, -1, "", -1,
+                                              {}, {}, {}, false)));
+    CHECK(indices(helper.FindMethodSetInvoking(method_idx)) ==
+          sorted(helper.FindMethodInvoking(method_idx, -1, -1, "", -1, {}, {},
+                                           {}, false)));
+    CHECK(indices(helper.FindMethodSetInvoked(method_idx)) ==
+          sorted(helper.FindMethodInvoked(method_idx, -1, -1, "", -1, {}, {},
+                                          {}, false)));
+    CHECK(indices(helper.FindMethodSetGettingField(field_idx)) ==
+          sorted(helper.FindMethodGettingField(field_idx, -1, -1, "", -1, {},
+                                               {}, {}, false)));
+    CHECK(indices(helper.FindMethodSetSettingField(field_idx)) ==
+          sorted(helper.FindMethodSettingField(field_idx, -1, -1, "", -1, {},
+                                               {}, {}, false)));
+
+    // filtering by the class of a method using the literal, or of none
+    auto found = indices(using_string);
+    auto filter_class =
+        !found.empty() && rng() % 4
+            ? std::string(helper.DecodeMethod(found[rng() % found.size()])
+                              .declaring_class.name)
+            : class_name;
+    auto matching = helper.FindMethodSetMatching(
+        -1, -1, "", helper.CreateClassIndex(filter_class), {}, {});
+    std::vector<size_t> expected, rest;
+    for (auto method : found) {
+      (helper.DecodeMethod(method).declaring_class.name == filter_class
+           ? expected
+           : rest)
+          .emplace_back(method);
+    }
+    CHECK(indices(using_string & matching) == expected);
+    CHECK(indices(using_string - matching) == rest);
+    CHECK(indices(using_string | matching) ==
+          indices(matching | using_string));
+
+    auto of_class = helper.FindMethodSetOfClass(class_idx);
+    CHECK(!of_class.empty());
+    CHECK(indices(of_class) ==
+          indices(helper.FindMethodSetMatching(-1, -1, "", class_idx, {}, {})));
+    for (auto method : indices(of_class))
+      CHECK(helper.DecodeMethod(method).declaring_class.name == class_name);
+  }
+}
+
+// The pool keeps its helpers under the budget by dropping the least
+// recently acquired ones, and an app answers the same once its helper was
+// built again.
+void TestHelperPool() {
+  auto &dexs = Dexes();
+  std::vector<DexList> apps = {
+      dexs, {dexs[0], dexs[1]}, {dexs[1], dexs[2]}, {dexs[2]}};
+  // room for about two apps, fewer once their caches fill
+  size_t budget = 2 * DexHelper(dexs).TableBytes();
+  DexHelperPool pool({.memory_budget = budget, .helper = {}});
+  for (size_t app = 0; app < apps.size(); ++app)
+    pool.Add("app" + std::to_string(app), apps[app]);
+  CHECK(!pool.Acquire("unknown"));
+
+  std::mt19937 rng(47);
+  for (size_t round = 0; round < 3; ++round) {
+    for (size_t app = 0; app < apps.size(); ++app) {
+      auto loads = pool.GetStats().loads;
+      bool reloaded;
+      auto *helper = pool.Acquire("app" + std::to_string(app), &reloaded);
+      CHECK(helper);
+      if (!helper)
+        continue;
+      CHECK(reloaded == (pool.GetStats().loads != loads));
+      DexHelper fresh(apps[app]);
+      for (size_t i = 0; i < 10; ++i) {
+        int kind = rng() % 3;
+        size_t target = rng() % kDexOptions.string_count;
+        CHECK(Names(*helper, Query(*helper, kind, target, false)) ==
+              Names(fresh, Query(fresh, kind, target, false)));
+      }
+      pool.Trim();
+      CHECK(pool.Bytes() <= budget);
+    }
+  }
+  CHECK(pool.GetStats().evictions != 0);
+  // every helper built is loaded still or was evicted
+  CHECK(pool.GetStats().loads ==
+        pool.GetStats().evictions + pool.LoadedCount());
+
+  bool reloaded;
+  pool.Acquire("app3", &reloaded);
+  pool.Acquire("app3", &reloaded);
+  CHECK(!reloaded);
+  auto loaded = pool.LoadedCount();
+  pool.Remove("app3");
+  CHECK(!pool.Acquire("app3"));
+  CHECK(pool.LoadedCount() == loaded - 1);
+}
+
+// little endian fields of a zip archive
+void Put(std::vector<uint8_t> &out, uint32_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    out.emplace_back(value >> (8 * i));
+}
+
+struct ZipEntry {
+  std::string name;
+  std::vector<uint8_t> data;
+  bool deflate;
+  // of the data in the archive, padded with the local header's extra field
+  // as zipalign does
+  size_t offset_mod_4 = 0;
+};
+
+std::vector<uint8_t> Zip(const std::vector<ZipEntry> &entries) {
+  std::vector<uint8_t> out, dir;
+  for (auto &entry : entries) {
+    auto data = entry.data;
+    if (entry.deflate) {
+      z_stream stream{};
+      deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY);
+      data.resize(deflateBound(&stream, entry.data.size()));
+      stream.next_in = const_cast<Bytef *>(entry.data.data());
+      stream.avail_in = entry.data.size();
+      stream.next_out = data.data();
+      stream.avail_out = data.size();
+      deflate(&stream, Z_FINISH);
+      data.resize(stream.total_out);
+      deflateEnd(&stream);
+    }
+    uint32_t crc = crc32(0, entry.data.data(), entry.data.size());
+    uint32_t offset = out.size();
+    size_t extra = (entry.offset_mod_4 + 8 -
+                    (offset + 30 + entry.name.size()) % 4) % 4;
+    // fields from the version needed to the name size, the same in the
+    // local header and the central directory
+    std::vector<uint8_t> common;
+    Put(common, 20, 2);
+    Put(common, 0, 2);
+    Put(common, entry.deflate ? 8 : 0, 2);
+    Put(common, 0, 4);
+    Put(common, crc, 4);
+    Put(common, data.size(), 4);
+    Put(common, entry.data.size(), 4);
+    Put(common, entry.name.size(), 2);
+
+    Put(out, 0x04034b50, 4);
+    out.insert(out.end(), common.begin(), common.end());
+    Put(out, extra, 2);
+    out.insert(out.end(), entry.name.begin(), entry.name.end());
+    out.resize(out.size() + extra);
+    out.insert(out.end(), data.begin(), data.end());
+
+    Put(dir, 0x02014b50, 4);
+    Put(dir, 20, 2);
+    dir.insert(dir.end(), common.begin(), common.end());
+    // zero extra and comment sizes, disk and attributes
+    dir.resize(dir.size() + 2 + 2 + 2 + 2 + 4);
+    Put(dir, offset, 4);
+    dir.insert(dir.end(), entry.name.begin(), entry.name.end());
+  }
+  uint32_t dir_offset = out.size();
+  out.insert(out.end(), dir.begin(), dir.end());
+  Put(out, 0x06054b50, 4);
+  Put(out, 0, 4);
+  Put(out, entries.size(), 2);
+  Put(out, entries.size(), 2);
+  Put(out, dir.size(), 4);
+  Put(out, dir_offset, 4);
+  Put(out, 0, 2);
+  return out;
+}
+
+// Loads the dexes of a zip built in memory: STORED entries at a 4-aligned
+// offset are mapped in place, the others inflated or copied into aligned
+// buffers. A truncated or corrupt archive loads nothing.
+void TestApkLoader() {
+  std::vector<std::vector<uint8_t>> images;
+  for (auto &[image, size] : Dexes()) {
+    auto *bytes = static_cast<const uint8_t *>(image);
+    images.emplace_back(bytes, bytes + size);
+  }
+  std::vector<ZipEntry> entries = {
+      {.name = "classes.dex", .data = images[0], .deflate = false},
+      {.name = "AndroidManifest.xml", .data = {1, 2, 3}, .deflate = true},
+      {.name = "classes2.dex", .data = images[1], .deflate = true},
+      {.name = "classes3.dex",
+       .data = images[2],
+       .deflate = false,
+       .offset_mod_4 = 2},
+      // past the gap at classes4.dex, which the runtime does not load
+      {.name = "classes5.dex", .data = images[0], .deflate = false}};
+  auto zip = Zip(entries);
+
+  char path[] = "/tmp/dexhelper-test-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd != -1);
+  close(fd);
+  // the dexes an apk holding zip loads
+  auto load = [&path](const std::vector<uint8_t> &zip) {
+    FILE *file = fopen(path, "wb");
+    if (!zip.empty())
+      fwrite(zip.data(), 1, zip.size(), file);
+    fclose(file);
+    ApkLoader apk(path);
+    std::vector<std::vector<uint8_t>> dexs;
+    for (auto &[image, size] : apk.Dexes()) {
+      auto *bytes = static_cast<const uint8_t *>(image);
+      dexs.emplace_back(bytes, bytes + size);
+    }
+    return dexs;
+  };
+  CHECK(load(zip) == images);
+
+  {
+    ApkLoader apk(path);
+    auto &dexs = apk.Dexes();
+    CHECK(dexs.size() == images.size());
+    auto page_offset = [](const void *image) {
+      return uintptr_t(image) % sysconf(_SC_PAGESIZE);
+    };
+    // mapped at the page offset of the data in the file, or copied to the
+    // start of a page
+    if (dexs.size() == images.size()) {
+      CHECK(page_offset(std::get<0>(dexs[0])) ==
+            size_t(std::search(zip.begin(), zip.end(), images[0].begin(),
+                               images[0].begin() + 64) -
+                   zip.begin()) %
+                sysconf(_SC_PAGESIZE));
+      CHECK(page_offset(std::get<0>(dexs[0])) % 4 == 0);
+      CHECK(page_offset(std::get<0>(dexs[1])) == 0);
+      CHECK(page_offset(std::get<0>(dexs[2])) == 0);
+      DexHelper helper(dexs), reference(Dexes());
+      for (size_t target = 0; target < 20; ++target) {
+        CHECK(Names(helper, Query(helper, target % 3, target, false)) ==
+              Names(reference, Query(reference, target % 3, target, false)));
+      }
+    }
+  }
+
+  // every cut of the central directory and the end record, and a few of
+  // the entries
+  size_t dir_offset = zip.size() - 22 - 46 * entries.size();
+  for (auto &entry : entries)
+    dir_offset -= entry.name.size();
+  for (size_t size = 0; size < zip.size(); size += size < dir_offset ? 997 : 1)
+    CHECK(load({zip.begin(), zip.begin() + size}).empty());
+
+  struct {
+    size_t offset;
+    uint8_t value;
+  } corruptions[] = {
+      // end record: entry count, directory size and offset
+      {zip.size() - 12, 0xff},
+      {zip.size() - 9, 0xff},
+      {zip.size() - 5, 0xff},
+      // the signature of the first central directory record, its method
+      // and its local header offset
+      {dir_offset, 0},
+      {dir_offset + 10, 12},
+      {dir_offset + 45, 0x7f},
+      // the signature of the first local header
+      {0, 0}};
+  for (auto [offset, value] : corruptions) {
+    auto corrupt = zip;
+    corrupt[offset] = value;
+    CHECK(load(corrupt).empty());
+  }
+  unlink(path);
+  CHECK(ApkLoader(path).Dexes().empty());
+}
+
+} // namespace
+
+int main() {
+  TestStringIndex();
+  TestFrozenPostings();
+  TestPostingsView();
+  TestRoaringSet();
+  TestIndexFile();
+  TestColdAndWarm();
+  TestIndexDir();
+  TestSharedIndex();
+  TestLazyInit();
+  TestAddAndRemoveDex();
+  TestRelations();
+  TestMemoryBudget();
+  TestMethodSets();
+  TestHelperPool();
+  TestApkLoader();
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
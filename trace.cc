@@ -0,0 +1,125 @@
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+#include "trace.h"
+
+namespace trace {
+
+namespace {
+constexpr size_t kRingSize = 8192;
+
+struct Event {
+  const char *name;
+  int64_t arg;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// written only by the thread holding it; the registry only ever grows, and
+// the ring of an exited thread goes to the next thread that starts
+struct Ring {
+  Ring *next = nullptr;
+  std::atomic<pid_t> tid = 0;
+  // held by a running thread
+  std::atomic_bool held = true;
+  std::atomic<uint64_t> head = 0;
+  Event events[kRingSize];
+};
+
+std::atomic_bool enabled = false;
+std::atomic<Ring *> rings = nullptr;
+
+// A ring released by an exited thread, or a new one. The events the exited
+// thread left are kept and dumped under the tid of the new holder: they
+// end before its own begin, so the lane stays well nested.
+Ring *AcquireRing() {
+  for (auto *ring = rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    bool held = false;
+    if (ring->held.compare_exchange_strong(held, true,
+                                           std::memory_order_acquire)) {
+      ring->tid.store(gettid(), std::memory_order_relaxed);
+      return ring;
+    }
+  }
+  auto *ring = new Ring();
+  ring->tid.store(gettid(), std::memory_order_relaxed);
+  ring->next = rings.load(std::memory_order_relaxed);
+  while (!rings.compare_exchange_weak(ring->next, ring,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+  }
+  return ring;
+}
+
+// releases the ring of its thread when the thread exits
+struct RingHolder {
+  Ring *ring = AcquireRing();
+  ~RingHolder() { ring->held.store(false, std::memory_order_release); }
+};
+
+Ring *ThreadRing() {
+  thread_local RingHolder holder;
+  return holder.ring;
+}
+} // namespace
+
+void Start() { enabled.store(true, std::memory_order_relaxed); }
+
+void Stop() { enabled.store(false, std::memory_order_relaxed); }
+
+bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+
+uint64_t Scope::Now() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Scope::Record(const char *name, int64_t arg, uint64_t begin,
+                   uint64_t end) {
+  auto *ring = ThreadRing();
+  auto head = ring->head.load(std::memory_order_relaxed);
+  ring->events[head % kRingSize] = {name, arg, begin, end};
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Clear() {
+  for (auto *ring = rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    ring->head.store(0, std::memory_order_release);
+  }
+}
+
+bool Dump(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out)
+    return false;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+  bool first = true;
+  auto pid = getpid();
+  for (auto *ring = rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    auto head = ring->head.load(std::memory_order_acquire);
+    for (auto i = head > kRingSize ? head - kRingSize : 0; i < head; ++i) {
+      auto &event = ring->events[i % kRingSize];
+      fprintf(out,
+              "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f",
+              first ? "" : ",", event.name, pid,
+              ring->tid.load(std::memory_order_relaxed),
+              event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+      if (event.arg != -1)
+        fprintf(out, ",\"args\":{\"arg\":%" PRId64 "}", event.arg);
+      fputc('}', out);
+      first = false;
+    }
+  }
+  fputs("\n]}\n", out);
+  return fclose(out) == 0;
+}
+
+} // namespace trace
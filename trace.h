@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+// Lightweight tracing of DexHelper phases, exported in the Chrome
+// trace_event JSON format (chrome://tracing, Perfetto UI).
+//
+// Events are recorded into lock-free per-thread ring buffers, only while
+// tracing is started; older events are overwritten once a ring is full.
+// Building with DEXHELPER_NO_TRACE compiles all the scopes out.
+namespace trace {
+
+void Start();
+void Stop();
+bool Enabled();
+
+// Writes every recorded event of every thread to path. Events recorded
+// concurrently with the dump may be torn, so dump after the traced work.
+bool Dump(const char *path);
+
+// Drops every recorded event.
+void Clear();
+
+// Records a complete event spanning its lifetime. name must outlive the
+// trace, e.g. a string literal.
+class Scope {
+public:
+  explicit Scope(const char *name, int64_t arg = -1)
+      : name_(name), arg_(arg), begin_(Enabled() ? Now() : 0) {}
+  ~Scope() {
+    if (begin_)
+      Record(name_, arg_, begin_, Now());
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  static uint64_t Now();
+  static void Record(const char *name, int64_t arg, uint64_t begin,
+                     uint64_t end);
+
+  const char *name_;
+  int64_t arg_;
+  uint64_t begin_;
+};
+
+} // namespace trace
+
+#ifdef DEXHELPER_NO_TRACE
+#define DEX_TRACE(name)
+#define DEX_TRACE_ARG(name, arg)
+#else
+#define DEX_TRACE_CONCAT_(a, b) a##b
+#define DEX_TRACE_CONCAT(a, b) DEX_TRACE_CONCAT_(a, b)
+#define DEX_TRACE(name) trace::Scope DEX_TRACE_CONCAT(trace_, __LINE__)(name)
+#define DEX_TRACE_ARG(name, arg)                                               \
+  trace::Scope DEX_TRACE_CONCAT(trace_, __LINE__)(name, int64_t(arg))
+#endif